@@ -1,4 +1,4 @@
-# - Try to find ffmpeg libraries (libavcodec, libavfilter, libavformat and libavutil)
+# - Try to find ffmpeg libraries (libavcodec, libavfilter, libavformat, libavutil and libswscale)
 # Once done this will define
 #
 # FFMPEG_FOUND - system has ffmpeg or libav
@@ -8,6 +8,7 @@
 # FFMPEG_LIBAVFILTER
 # FFMPEG_LIBAVFORMAT
 # FFMPEG_LIBAVUTIL
+# FFMPEG_LIBSWSCALE
 #
 # Copyright (c) 2008 Andreas Schneider <mail@cynapses.org>
 # Modified for other libraries by Lasse Kärkkäinen <tronic>
@@ -30,6 +31,7 @@ else (FFMPEG_LIBRARIES AND FFMPEG_INCLUDE_DIR)
         pkg_check_modules(_FFMPEG_AVFILTER libavfilter)
         pkg_check_modules(_FFMPEG_AVFORMAT libavformat)
         pkg_check_modules(_FFMPEG_AVUTIL libavutil)
+        pkg_check_modules(_FFMPEG_SWSCALE libswscale)
     endif (PKG_CONFIG_FOUND)
 
     find_path(FFMPEG_AVCODEC_INCLUDE_DIR
@@ -58,6 +60,11 @@ else (FFMPEG_LIBRARIES AND FFMPEG_INCLUDE_DIR)
             PATHS ${_FFMPEG_AVUTIL_LIBRARY_DIRS} /usr/lib /usr/local/lib /opt/local/lib /sw/lib
             )
 
+    find_library(FFMPEG_LIBSWSCALE
+            NAMES swscale
+            PATHS ${_FFMPEG_SWSCALE_LIBRARY_DIRS} /usr/lib /usr/local/lib /opt/local/lib /sw/lib
+            )
+
     if (FFMPEG_LIBAVCODEC AND FFMPEG_LIBAVFILTER AND FFMPEG_LIBAVFORMAT)
         set(FFMPEG_FOUND TRUE)
     endif()
@@ -70,6 +77,7 @@ else (FFMPEG_LIBRARIES AND FFMPEG_INCLUDE_DIR)
                 ${FFMPEG_LIBAVFILTER}
                 ${FFMPEG_LIBAVFORMAT}
                 ${FFMPEG_LIBAVUTIL}
+                ${FFMPEG_LIBSWSCALE}
                 )
 
     endif (FFMPEG_FOUND)
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+#include "band_pool.h"
+
+void band_pool_init(struct band_pool *pool, int threads) {
+    memset(pool, 0, sizeof(struct band_pool));
+    pool->threads = threads > 0 ? threads : 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+}
+
+/*
+ * Takes bands until none is left. Called and returns with the lock held.
+ */
+static void run_bands(struct band_pool *pool) {
+    while (pool->next < pool->count) {
+        int index = pool->next++, count = pool->count;
+        band_pool_fn fn = pool->fn;
+        void *arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+        fn(arg, index, count);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct band_pool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->next >= pool->count)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->stop)
+            break;
+        run_bands(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+ * Starts threads - 1 workers, or as many as the system allows. Without any, the bands run on the caller.
+ */
+static void start_workers(struct band_pool *pool) {
+    pool->workers = calloc((size_t) pool->threads - 1, sizeof(pthread_t));
+    if (pool->workers == NULL) {
+        pool->threads = 1;
+        return;
+    }
+    while (pool->started < pool->threads - 1 &&
+           pthread_create(&pool->workers[pool->started], NULL, worker_main, pool) == 0)
+        pool->started++;
+    pool->threads = pool->started + 1;
+}
+
+/*
+ * Runs fn on every band and returns when all of them are done.
+ */
+void band_pool_run(struct band_pool *pool, band_pool_fn fn, void *arg, int count) {
+    if (count > 1 && pool->threads > 1 && pool->workers == NULL)
+        start_workers(pool);
+    if (count <= 1 || pool->started == 0) {
+        for (int b = 0; b < count; b++)
+            fn(arg, b, count);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->count = count;
+    pool->next = 0;
+    pool->pending = count;
+    pthread_cond_broadcast(&pool->work);
+    run_bands(pool);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Stops the workers. Does nothing on a zeroed pool that was never initialized.
+ */
+void band_pool_uninit(struct band_pool *pool) {
+    if (pool->threads == 0)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->started; i++)
+        pthread_join(pool->workers[i], NULL);
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->started = 0;
+    pool->threads = 0;
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+}
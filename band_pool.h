@@ -0,0 +1,34 @@
+#ifndef FRAME_EXTRACTOR_BAND_POOL_H
+#define FRAME_EXTRACTOR_BAND_POOL_H
+
+#include <pthread.h>
+
+/*
+ * Processes band index out of count bands of the current frame.
+ */
+typedef void (*band_pool_fn)(void *arg, int index, int count);
+
+/*
+ * Threads that run the bands of one frame at a time, for the per-frame filters. They are started by the first
+ * frame that has several bands and then wait between frames. The calling thread works on the bands as well.
+ */
+struct band_pool {
+    int threads;
+    int started;
+    pthread_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    band_pool_fn fn;
+    void *arg;
+    int count;
+    int next;
+    int pending;
+    int stop;
+};
+
+void band_pool_init(struct band_pool *pool, int threads);
+void band_pool_run(struct band_pool *pool, band_pool_fn fn, void *arg, int count);
+void band_pool_uninit(struct band_pool *pool);
+
+#endif //FRAME_EXTRACTOR_BAND_POOL_H
@@ -0,0 +1,370 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libavformat/avformat.h>
+#include <libavutil/cpu.h>
+#include "batch.h"
+#include "encoder_pool.h"
+
+#define MANIFEST_LINE_MAX 8192
+#define BATCH_WINDOW 65536
+
+struct batch_job {
+    unsigned int line;
+    char *input;
+    char *times;
+    char *output;
+};
+
+/*
+ * The output file of a running job, opened by its first packet.
+ */
+struct batch_output {
+    const char *filename;
+    const AVCodecParameters *codecpar;
+    AVRational time_base;
+    AVFormatContext *fmt_ctx;
+    AVStream *stream;
+    unsigned long frames;
+    uint64_t bytes;
+};
+
+/*
+ * The workers take the jobs in manifest order. Every job runs its own extractor, and the encoders
+ * are shared between them through the pool.
+ */
+struct batch {
+    struct extractor_options options;
+    enum timestamps_format format;
+    AVRational time_base;
+    volatile int *stop;
+    struct batch_job *jobs;
+    unsigned int job_count;
+    unsigned int job_next;
+    pthread_mutex_t lock;
+    struct encoder_pool encoders;
+    unsigned int failed;
+    unsigned long frames;
+    uint64_t bytes;
+};
+
+static void free_jobs(struct batch *batch) {
+    for (unsigned int i = 0; i < batch->job_count; i++) {
+        free(batch->jobs[i].input);
+        free(batch->jobs[i].times);
+        free(batch->jobs[i].output);
+    }
+    free(batch->jobs);
+    batch->jobs = NULL;
+    batch->job_count = 0;
+}
+
+/*
+ * Splits a manifest line into its fields, at tabs if it has any, so that paths may hold spaces, else at spaces.
+ * Returns the number of fields, up to max.
+ */
+static unsigned int split_fields(char *line, char **fields, unsigned int max) {
+    unsigned int count = 0;
+    const char *separators = strchr(line, '\t') != NULL ? "\t\r\n" : " \r\n";
+    char *field = strtok(line, separators);
+    while (field != NULL && count < max + 1) {
+        if (count < max)
+            fields[count] = field;
+        count++;
+        field = strtok(NULL, separators);
+    }
+    return count;
+}
+
+/*
+ * Reads the jobs of the manifest, one INPUT TIMES OUTPUT line each. Blank lines and lines starting with #
+ * are skipped.
+ */
+static int read_manifest(struct batch *batch, const char *filename) {
+    int ret = 0;
+    unsigned int line_number = 0, capacity = 0;
+    char line[MANIFEST_LINE_MAX];
+    char *fields[3];
+    FILE *file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+
+    if (file == NULL) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not open the manifest %s: %s\n", filename, av_err2str(ret));
+        return ret;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        unsigned int count;
+        struct batch_job *job;
+        line_number++;
+        if (strchr(line, '\n') == NULL && !feof(file)) {
+            fprintf(stderr, "Manifest line %u is too long\n", line_number);
+            ret = AVERROR_INVALIDDATA;
+            break;
+        }
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#')
+            continue;
+        if ((count = split_fields(line, fields, 3)) != 3) {
+            fprintf(stderr, "Manifest line %u: expected INPUT TIMES OUTPUT, got %u fields\n", line_number, count);
+            ret = AVERROR_INVALIDDATA;
+            break;
+        }
+        if (batch->job_count == capacity) {
+            unsigned int grown = capacity > 0 ? capacity * 2 : 64;
+            struct batch_job *resized = realloc(batch->jobs, grown * sizeof(struct batch_job));
+            if (resized == NULL) {
+                ret = AVERROR(ENOMEM);
+                break;
+            }
+            batch->jobs = resized;
+            capacity = grown;
+        }
+        job = &batch->jobs[batch->job_count];
+        job->line = line_number;
+        job->input = strdup(fields[0]);
+        job->times = strdup(fields[1]);
+        job->output = strdup(fields[2]);
+        batch->job_count++;
+        if (job->input == NULL || job->times == NULL || job->output == NULL) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+    }
+    if (ret == 0 && ferror(file))
+        ret = AVERROR(EIO);
+    if (file != stdin)
+        fclose(file);
+    return ret;
+}
+
+static int open_output(struct batch_output *output) {
+    int ret;
+    avformat_alloc_output_context2(&output->fmt_ctx, NULL, NULL, output->filename);
+    if (!output->fmt_ctx) {
+        av_log(NULL, AV_LOG_ERROR, "Could not create output context\n");
+        return AVERROR_UNKNOWN;
+    }
+    output->stream = avformat_new_stream(output->fmt_ctx, NULL);
+    if (!output->stream) {
+        av_log(NULL, AV_LOG_ERROR, "Failed allocating output stream\n");
+        ret = AVERROR_UNKNOWN;
+        goto fail;
+    }
+    if ((ret = avcodec_parameters_copy(output->stream->codecpar, output->codecpar)) < 0)
+        goto fail;
+    output->stream->time_base = output->time_base;
+    output->stream->avg_frame_rate = (AVRational) {1, 1};
+    output->stream->sample_aspect_ratio = output->codecpar->sample_aspect_ratio;
+
+    if ((ret = avio_open(&output->fmt_ctx->pb, output->filename, AVIO_FLAG_WRITE)) != 0) {
+        fprintf(stderr, "Failed to open the output file %s: %s\n", output->filename, av_err2str(ret));
+        goto fail;
+    }
+    if ((ret = avformat_write_header(output->fmt_ctx, NULL)) < 0) {
+        fprintf(stderr, "Failed to write output header: %s\n", av_err2str(ret));
+        goto fail;
+    }
+    return 0;
+
+    fail:
+    avio_closep(&output->fmt_ctx->pb);
+    avformat_free_context(output->fmt_ctx);
+    output->fmt_ctx = NULL;
+    return ret;
+}
+
+static int close_output(struct batch_output *output) {
+    int ret, close_ret;
+    if (output->fmt_ctx == NULL)
+        return 0;
+    if ((ret = av_write_trailer(output->fmt_ctx)) != 0)
+        fprintf(stderr, "Failed to write output trailer: %s\n", av_err2str(ret));
+    if ((close_ret = avio_closep(&output->fmt_ctx->pb)) != 0) {
+        fprintf(stderr, "Failed to close the output file: %s\n", av_err2str(close_ret));
+        if (ret == 0)
+            ret = close_ret;
+    }
+    avformat_free_context(output->fmt_ctx);
+    output->fmt_ctx = NULL;
+    return ret;
+}
+
+/*
+ * Writes a packet of a job into its output file. Runs on the output thread of the job's extractor.
+ */
+static int write_packet(void *opaque, AVPacket *packet) {
+    int ret;
+    int packet_size = packet->size;
+    struct batch_output *output = opaque;
+
+    if (output->fmt_ctx == NULL && (ret = open_output(output)) < 0) {
+        fprintf(stderr, "Could not open the destination file: %s\n", av_err2str(ret));
+        return ret;
+    }
+    packet->pts = packet->dts = av_rescale_q(output->frames + 1, output->time_base, output->stream->time_base);
+    if ((ret = av_interleaved_write_frame(output->fmt_ctx, packet)) != 0) {
+        fprintf(stderr, "Failed to write output frame: %s\n", av_err2str(ret));
+        return ret;
+    }
+    output->frames++;
+    output->bytes += packet_size;
+    return 0;
+}
+
+/*
+ * Extracts the frames of one job into its output file and prints its throughput.
+ * The times arrays are kept by the worker across its jobs.
+ */
+static int run_job(struct batch *batch, const struct batch_job *job, struct timestamps *input, int64_t **times,
+                   uint8_t **sequential, unsigned int *capacity) {
+    int ret, close_ret;
+    double seconds;
+    struct extractor *ex = NULL;
+    struct stats stats;
+    struct extractor_options options = batch->options;
+    struct batch_output output = {.filename = job->output, .time_base = batch->time_base};
+    int64_t start = av_gettime_relative();
+
+    stats_init(&stats, batch->options.stats != NULL);
+    options.stats = batch->options.stats != NULL ? &stats : NULL;
+    options.packet_cb = write_packet;
+    options.opaque = &output;
+    options.encoders = &batch->encoders;
+
+    if ((ret = timestamps_open(input, job->times, batch->format)) < 0)
+        goto end;
+    if ((ret = extractor_open(&ex, job->input, &options)) < 0)
+        goto end;
+    output.codecpar = extractor_codecpar(ex);
+    timestamps_set_frame_rate(input, extractor_frame_rate(ex));
+
+    while (*batch->stop == 0 && (ret = timestamps_read(input, BATCH_WINDOW, times, sequential, capacity)) > 0) {
+        if ((ret = extractor_extract_sequential(ex, *times, *sequential, (unsigned int) ret)) != 0)
+            break;
+    }
+    if (ret == 0 && *batch->stop != 0)
+        ret = AVERROR_EXIT;
+
+    end:
+    if ((close_ret = extractor_close(&ex)) != 0 && ret >= 0)
+        ret = close_ret;
+    if ((close_ret = close_output(&output)) != 0 && ret >= 0)
+        ret = close_ret;
+    timestamps_close(input);
+
+    seconds = (av_gettime_relative() - start) / 1e+6;
+    if (ret < 0)
+        fprintf(stderr, "Job %u %s failed after %lu frames: %s\n", job->line, job->input, output.frames,
+                av_err2str(ret));
+    else
+        fprintf(stderr, "Job %u %s: %lu frames in %.3f s, %.1f fps, %.1f MiB written to %s\n", job->line,
+                job->input, output.frames, seconds, seconds > 0 ? output.frames / seconds : 0.0,
+                output.bytes / 1048576.0, job->output);
+
+    pthread_mutex_lock(&batch->lock);
+    if (ret < 0)
+        batch->failed++;
+    batch->frames += output.frames;
+    batch->bytes += output.bytes;
+    if (batch->options.stats != NULL) {
+        stats.bytes_written = output.bytes;
+        stats_add(batch->options.stats, &stats);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return ret;
+}
+
+static void *worker_main(void *arg) {
+    struct batch *batch = arg;
+    int64_t *times = NULL;
+    uint8_t *sequential = NULL;
+    unsigned int capacity = 0;
+    struct timestamps *input = malloc(sizeof(struct timestamps));
+
+    if (input == NULL) {
+        fprintf(stderr, "Could not allocate a batch worker\n");
+        return NULL;
+    }
+    for (;;) {
+        const struct batch_job *job = NULL;
+        pthread_mutex_lock(&batch->lock);
+        if (*batch->stop == 0 && batch->job_next < batch->job_count)
+            job = &batch->jobs[batch->job_next++];
+        pthread_mutex_unlock(&batch->lock);
+        if (job == NULL)
+            break;
+        run_job(batch, job, input, &times, &sequential, &capacity);
+    }
+    free(times);
+    free(sequential);
+    free(input);
+    return NULL;
+}
+
+/*
+ * Runs the jobs of the manifest on a fixed pool of workers, each job with its own extractor, and prints
+ * the throughput of every job and of the whole batch. Returns a negative error code if any job failed.
+ */
+int batch_run(const char *manifest, const struct extractor_options *options, unsigned int workers,
+              unsigned int framerate, enum timestamps_format format, volatile int *stop) {
+    int ret;
+    int64_t start = av_gettime_relative();
+    double seconds;
+    unsigned int started = 0, cores = (unsigned int) FFMAX(1, av_cpu_count());
+    pthread_t *threads;
+    struct batch batch;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.options = *options;
+    batch.format = format;
+    batch.time_base = (AVRational) {1, (int) framerate};
+    batch.stop = stop;
+    if ((ret = read_manifest(&batch, manifest)) < 0) {
+        free_jobs(&batch);
+        return ret;
+    }
+    if (workers == 0)
+        workers = cores;
+    workers = FFMAX(1, FFMIN(workers, batch.job_count));
+    if (batch.options.decoder_threads == 0)
+        batch.options.decoder_threads = FFMAX(1, (cores + workers * batch.options.jobs - 1) /
+                                                 (workers * batch.options.jobs));
+    if (batch.options.encoder_threads == 0)
+        batch.options.encoder_threads = FFMAX(1, (cores + workers - 1) / workers);
+
+    if ((ret = encoder_pool_init(&batch.encoders, workers * 2)) < 0) {
+        free_jobs(&batch);
+        return ret;
+    }
+    if ((threads = calloc(workers, sizeof(pthread_t))) == NULL) {
+        encoder_pool_free(&batch.encoders);
+        free_jobs(&batch);
+        return AVERROR(ENOMEM);
+    }
+    pthread_mutex_init(&batch.lock, NULL);
+    for (; started < workers; started++) {
+        if ((ret = pthread_create(&threads[started], NULL, worker_main, &batch)) != 0) {
+            fprintf(stderr, "Could not start a batch worker: %s\n", strerror(ret));
+            break;
+        }
+    }
+    if (started == 0)
+        worker_main(&batch);
+    for (unsigned int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    seconds = (av_gettime_relative() - start) / 1e+6;
+    fprintf(stderr, "Batch: %u jobs on %u workers, %u failed, %lu frames in %.3f s, %.1f fps, %.1f MiB written\n",
+            batch.job_next, workers, batch.failed, batch.frames, seconds,
+            seconds > 0 ? batch.frames / seconds : 0.0, batch.bytes / 1048576.0);
+    fprintf(stderr, "Encoders: %lu reused, %lu opened\n", (unsigned long) batch.encoders.hits,
+            (unsigned long) batch.encoders.misses);
+    ret = batch.failed > 0 || batch.job_next < batch.job_count ? AVERROR_EXTERNAL : 0;
+
+    pthread_mutex_destroy(&batch.lock);
+    encoder_pool_free(&batch.encoders);
+    free(threads);
+    free_jobs(&batch);
+    return ret;
+}
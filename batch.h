@@ -0,0 +1,10 @@
+#ifndef FRAME_EXTRACTOR_BATCH_H
+#define FRAME_EXTRACTOR_BATCH_H
+
+#include "extractor.h"
+#include "timestamps.h"
+
+int batch_run(const char *manifest, const struct extractor_options *options, unsigned int workers,
+              unsigned int framerate, enum timestamps_format format, volatile int *stop);
+
+#endif //FRAME_EXTRACTOR_BATCH_H
@@ -0,0 +1,380 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+#include "extractor.h"
+
+#define FRAME_RATE 25
+#define FRAME_COUNT 750
+#define RANDOM_COUNT 200
+#define DUPLICATED_DISTINCT 25
+#define DUPLICATED_COUNT 200
+#define REVERSE_STEP_US 100000
+
+struct bench_source {
+    const char *codec;
+    int width;
+    int height;
+    int gop_size;
+    int max_b_frames;
+};
+
+/*
+ * Several codecs, GOP lengths, resolutions and B-frame settings. MJPEG exercises the packet copy path.
+ * Sources whose encoder is missing from the linked libavcodec are skipped.
+ */
+static const struct bench_source sources[] = {
+        {"mpeg4",      640,  360,  12,  0},
+        {"mpeg4",      1920, 1080, 250, 2},
+        {"mpeg2video", 1280, 720,  15,  2},
+        {"libx264",    1280, 720,  250, 3},
+        {"libx264",    1920, 1080, 50,  0},
+        {"mjpeg",      1280, 720,  1,   0},
+};
+
+enum workload {
+    WORKLOAD_DENSE,
+    WORKLOAD_SPARSE,
+    WORKLOAD_RANDOM,
+    WORKLOAD_DUPLICATED,
+    WORKLOAD_REVERSE,
+    WORKLOAD_COUNT
+};
+
+static const char *workload_names[WORKLOAD_COUNT] = {"dense", "sparse", "random", "duplicated", "reverse"};
+
+static unsigned int jobs = 1;
+static double rss_margin_mib = 0.0;
+static uint64_t packets = 0;
+
+static void source_name(const struct bench_source *bs, char *name, size_t size) {
+    snprintf(name, size, "%s_%dx%d_gop%d_bf%d", bs->codec, bs->width, bs->height, bs->gop_size, bs->max_b_frames);
+}
+
+/*
+ * Draws a moving gradient with some noise, so that the encoders have motion and detail to work on.
+ */
+static void fill_frame(AVFrame *frame, int index) {
+    unsigned int noise = (unsigned int) index * 2654435761u;
+    for (int y = 0; y < frame->height; y++) {
+        uint8_t *row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < frame->width; x++) {
+            noise = noise * 1103515245u + 12345u;
+            row[x] = (uint8_t) (x + y + index * 3 + ((noise >> 16) & 15));
+        }
+    }
+    for (int y = 0; y < frame->height / 2; y++) {
+        uint8_t *u = frame->data[1] + y * frame->linesize[1];
+        uint8_t *v = frame->data[2] + y * frame->linesize[2];
+        for (int x = 0; x < frame->width / 2; x++) {
+            u[x] = (uint8_t) (128 + y + index * 2);
+            v[x] = (uint8_t) (64 + x + index * 5);
+        }
+    }
+}
+
+static int write_packets(AVCodecContext *codec_ctx, AVFormatContext *fmt_ctx, AVStream *stream, AVPacket *packet) {
+    int ret;
+    while ((ret = avcodec_receive_packet(codec_ctx, packet)) == 0) {
+        av_packet_rescale_ts(packet, codec_ctx->time_base, stream->time_base);
+        packet->stream_index = stream->index;
+        if ((ret = av_interleaved_write_frame(fmt_ctx, packet)) < 0)
+            return ret;
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/*
+ * Encodes FRAME_COUNT synthetic frames into filename. Returns AVERROR_ENCODER_NOT_FOUND if the codec
+ * is not available.
+ */
+static int generate_source(const struct bench_source *bs, const char *filename) {
+    int ret;
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *codec_ctx = NULL;
+    AVStream *stream;
+    AVFrame *frame = NULL;
+    AVPacket *packet = NULL;
+    AVCodec *encoder = avcodec_find_encoder_by_name(bs->codec);
+
+    if (encoder == NULL)
+        return AVERROR_ENCODER_NOT_FOUND;
+    if ((ret = avformat_alloc_output_context2(&fmt_ctx, NULL, NULL, filename)) < 0)
+        return ret;
+    if ((stream = avformat_new_stream(fmt_ctx, NULL)) == NULL ||
+        (codec_ctx = avcodec_alloc_context3(encoder)) == NULL ||
+        (frame = av_frame_alloc()) == NULL || (packet = av_packet_alloc()) == NULL) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    codec_ctx->width = bs->width;
+    codec_ctx->height = bs->height;
+    codec_ctx->time_base = (AVRational) {1, FRAME_RATE};
+    codec_ctx->framerate = (AVRational) {FRAME_RATE, 1};
+    codec_ctx->gop_size = bs->gop_size;
+    codec_ctx->max_b_frames = bs->max_b_frames;
+    codec_ctx->pix_fmt = encoder->pix_fmts != NULL ? encoder->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+    codec_ctx->bit_rate = (int64_t) bs->width * bs->height * 2;
+    if (fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+        codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if ((ret = avcodec_open2(codec_ctx, encoder, NULL)) < 0 ||
+        (ret = avcodec_parameters_from_context(stream->codecpar, codec_ctx)) < 0)
+        goto end;
+    stream->time_base = codec_ctx->time_base;
+    if ((ret = avio_open(&fmt_ctx->pb, filename, AVIO_FLAG_WRITE)) < 0 ||
+        (ret = avformat_write_header(fmt_ctx, NULL)) < 0)
+        goto end;
+
+    frame->format = codec_ctx->pix_fmt;
+    frame->width = codec_ctx->width;
+    frame->height = codec_ctx->height;
+    if ((ret = av_frame_get_buffer(frame, 0)) < 0)
+        goto end;
+    for (int i = 0; i < FRAME_COUNT; i++) {
+        if ((ret = av_frame_make_writable(frame)) < 0)
+            goto end;
+        fill_frame(frame, i);
+        frame->pts = i;
+        if ((ret = avcodec_send_frame(codec_ctx, frame)) < 0 ||
+            (ret = write_packets(codec_ctx, fmt_ctx, stream, packet)) < 0)
+            goto end;
+    }
+    if ((ret = avcodec_send_frame(codec_ctx, NULL)) < 0 ||
+        (ret = write_packets(codec_ctx, fmt_ctx, stream, packet)) < 0)
+        goto end;
+    ret = av_write_trailer(fmt_ctx);
+
+    end:
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&codec_ctx);
+    if (fmt_ctx != NULL)
+        avio_closep(&fmt_ctx->pb);
+    avformat_free_context(fmt_ctx);
+    if (ret < 0)
+        remove(filename);
+    return ret;
+}
+
+/*
+ * Fills times with the request times of the workload, in microseconds, and returns their number.
+ * The random workloads use a fixed seed so that every run requests the same frames.
+ */
+static unsigned int build_times(enum workload workload, int64_t *times) {
+    const int64_t frame_us = 1000000 / FRAME_RATE;
+    const int64_t duration_us = FRAME_COUNT * frame_us;
+    unsigned int count = 0;
+    unsigned int seed = 1;
+
+    switch (workload) {
+        case WORKLOAD_DENSE:
+            for (int64_t ts = 0; ts < duration_us; ts += frame_us)
+                times[count++] = ts;
+            break;
+        case WORKLOAD_SPARSE:
+            for (int64_t ts = 0; ts < duration_us; ts += 2000000)
+                times[count++] = ts;
+            break;
+        case WORKLOAD_RANDOM:
+            while (count < RANDOM_COUNT) {
+                seed = seed * 1103515245u + 12345u;
+                times[count++] = (int64_t) (seed >> 8) % duration_us;
+            }
+            break;
+        case WORKLOAD_DUPLICATED:
+            while (count < DUPLICATED_COUNT) {
+                seed = seed * 1103515245u + 12345u;
+                times[count++] = (int64_t) ((seed >> 8) % DUPLICATED_DISTINCT) * (duration_us / DUPLICATED_DISTINCT);
+            }
+            break;
+        case WORKLOAD_REVERSE:
+            for (int64_t ts = duration_us - frame_us; ts >= 0; ts -= REVERSE_STEP_US)
+                times[count++] = ts;
+            break;
+        default:
+            break;
+    }
+    return count;
+}
+
+static int count_packet(void *opaque, AVPacket *packet) {
+    (void) opaque;
+    (void) packet;
+    packets++;
+    return 0;
+}
+
+static double peak_rss_mib() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0.0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1048576.0;
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+/*
+ * Runs one workload through the extractor and prints its result row. Runs in a child process of its own,
+ * so that the peak RSS is that of this run alone.
+ */
+static int run_workload(const char *name, const char *filename, enum workload workload) {
+    int ret;
+    int64_t start;
+    double seconds;
+    struct extractor *extractor = NULL;
+    struct extractor_options options;
+    struct stats stats;
+    int64_t times[FRAME_COUNT];
+    unsigned int count = build_times(workload, times);
+
+    extractor_default_options(&options);
+    options.jobs = jobs;
+    options.packet_cb = count_packet;
+    options.stats = &stats;
+    stats_init(&stats, 1);
+
+    start = av_gettime_relative();
+    if ((ret = extractor_open(&extractor, filename, &options)) < 0 ||
+        (ret = extractor_extract(extractor, times, count)) < 0 || (ret = extractor_close(&extractor)) < 0) {
+        fprintf(stderr, "%s %s failed: %s\n", name, workload_names[workload], av_err2str(ret));
+        extractor_close(&extractor);
+        return ret;
+    }
+    seconds = (av_gettime_relative() - start) / 1e+6;
+    printf("%-36s %-10s %7u %7lu %9.3f %9.1f %9.2f %9.1f\n", name, workload_names[workload], count,
+           (unsigned long) packets, seconds, seconds > 0 ? packets / seconds : 0.0,
+           stats.frames_emitted > 0 ? (double) stats.frames_decoded / stats.frames_emitted : 0.0, peak_rss_mib());
+    return 0;
+}
+
+/*
+ * Runs a workload in a child process and sets rss_mib to its peak RSS.
+ */
+static int run_child(const char *name, const char *filename, enum workload workload, double *rss_mib) {
+    int status;
+    pid_t pid;
+    struct rusage usage;
+
+    fflush(stdout);
+    if ((pid = fork()) < 0)
+        return AVERROR(errno);
+    if (pid == 0)
+        _exit(run_workload(name, filename, workload) < 0 ? 1 : 0);
+    if (wait4(pid, &status, 0, &usage) < 0)
+        return AVERROR(errno);
+#ifdef __APPLE__
+    *rss_mib = usage.ru_maxrss / 1048576.0;
+#else
+    *rss_mib = usage.ru_maxrss / 1024.0;
+#endif
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : AVERROR_EXTERNAL;
+}
+
+static int workload_selected(const char *list, enum workload workload) {
+    size_t length = strlen(workload_names[workload]);
+    for (const char *name = list; name != NULL; name = strchr(name, ',') != NULL ? strchr(name, ',') + 1 : NULL) {
+        if (strncmp(name, workload_names[workload], length) == 0 && (name[length] == ',' || name[length] == '\0'))
+            return 1;
+    }
+    return 0;
+}
+
+static void print_usage(const char *self) {
+    fprintf(stderr, "Usage: %s [-j JOBS] [-w WORKLOAD[,WORKLOAD]...] [-r MIB] [DIR]\n"
+                    "\n"
+                    "Generates synthetic sources into DIR (default bench-data) unless they are already there,\n"
+                    "then extracts the dense, sparse, random, duplicated and reverse-ordered workloads from each\n"
+                    "and prints one row per run: frames requested and emitted, seconds, emitted frames per second,\n"
+                    "frames decoded per frame emitted and peak RSS in MiB.\n"
+                    "\n"
+                    "  -w LIST   run only the listed workloads\n"
+                    "  -r MIB    fail if the peak RSS of a workload exceeds that of the dense workload of the same\n"
+                    "            source by more than MIB MiB, which catches frames piling up while they wait to be\n"
+                    "            emitted in order; the dense workload is run as well\n", self);
+}
+
+int main(int argc, char **argv) {
+    int opt, failed = 0;
+    const char *dir, *workloads = NULL;
+
+    while ((opt = getopt(argc, argv, "hj:w:r:")) != -1) {
+        switch (opt) {
+            case 'j':
+                jobs = (unsigned int) strtoul(optarg, NULL, 10);
+                if (jobs < 1) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'w':
+                workloads = optarg;
+                break;
+            case 'r':
+                rss_margin_mib = strtod(optarg, NULL);
+                if (rss_margin_mib <= 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (argc - optind > 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    dir = optind < argc ? argv[optind] : "bench-data";
+    mkdir(dir, 0755);
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+    av_register_all();
+#endif
+    av_log_set_level(AV_LOG_ERROR);
+
+    printf("%-36s %-10s %7s %7s %9s %9s %9s %9s\n", "source", "workload", "frames", "emitted", "seconds", "fps",
+           "dec/emit", "rss_mib");
+    for (unsigned int s = 0; s < sizeof(sources) / sizeof(sources[0]); s++) {
+        int ret;
+        char name[128], filename[1024];
+        struct stat st;
+
+        source_name(&sources[s], name, sizeof(name));
+        snprintf(filename, sizeof(filename), "%s/%s.mkv", dir, name);
+        if (stat(filename, &st) != 0 && (ret = generate_source(&sources[s], filename)) < 0) {
+            if (ret != AVERROR_ENCODER_NOT_FOUND) {
+                fprintf(stderr, "Could not generate %s: %s\n", filename, av_err2str(ret));
+                failed = 1;
+            }
+            continue;
+        }
+        double dense_rss = 0.0;
+        for (int w = 0; w < WORKLOAD_COUNT; w++) {
+            double rss = 0.0;
+            if (workloads != NULL && !workload_selected(workloads, (enum workload) w) &&
+                !(w == WORKLOAD_DENSE && rss_margin_mib > 0))
+                continue;
+            if (run_child(name, filename, (enum workload) w, &rss) < 0) {
+                failed = 1;
+                continue;
+            }
+            if (w == WORKLOAD_DENSE)
+                dense_rss = rss;
+            else if (rss_margin_mib > 0 && rss > dense_rss + rss_margin_mib) {
+                fprintf(stderr, "%s %s: peak RSS of %.1f MiB, more than %.0f MiB above the dense workload\n", name,
+                        workload_names[w], rss, rss_margin_mib);
+                failed = 1;
+            }
+        }
+    }
+    return failed ? 3 : 0;
+}
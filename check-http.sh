@@ -0,0 +1,75 @@
+#!/bin/sh
+# Extracts the same frames from a local file with -I http, through a loopback HTTP server that answers range
+# requests, and with -I pread, and checks that both outputs are identical.
+#
+# Usage: check-http.sh FRAME_EXTRACTOR [INPUT]
+# Without INPUT, a 60-second H.264 test source is generated with ffmpeg. Needs python3.
+set -e
+
+extractor=${1:?usage: $0 FRAME_EXTRACTOR [INPUT]}
+dir=$(mktemp -d)
+server=
+trap '[ -n "$server" ] && kill "$server" 2>/dev/null; rm -rf "$dir"' EXIT INT TERM
+
+if [ -n "$2" ]; then
+    cp "$2" "$dir/input.${2##*.}"
+    input=$(basename "$dir"/input.*)
+else
+    input=input.mp4
+    ffmpeg -v error -f lavfi -i testsrc2=size=1280x720:rate=25:duration=60 -c:v libx264 -pix_fmt yuv420p \
+        -g 50 -bf 2 "$dir/$input"
+fi
+
+# http.server only serves whole files, the fetcher reads the input through byte ranges
+cat > "$dir/server.py" <<'EOF'
+import functools, http.server, io, os, re, sys
+
+class RangeHandler(http.server.SimpleHTTPRequestHandler):
+    def send_head(self):
+        match = re.fullmatch(r'bytes=(\d+)-(\d*)', self.headers.get('Range', ''))
+        if match is None:
+            return super().send_head()
+        try:
+            f = open(self.translate_path(self.path), 'rb')
+        except OSError:
+            self.send_error(404)
+            return None
+        with f:
+            size = os.fstat(f.fileno()).st_size
+            first = int(match.group(1))
+            last = min(int(match.group(2)) if match.group(2) else size - 1, size - 1)
+            if first > last:
+                self.send_error(416)
+                return None
+            f.seek(first)
+            data = f.read(last - first + 1)
+        self.send_response(206)
+        self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('Content-Range', 'bytes %d-%d/%d' % (first, last, size))
+        self.send_header('Content-Length', str(len(data)))
+        self.end_headers()
+        return io.BytesIO(data)
+
+    def log_message(self, *args):
+        pass
+
+handler = functools.partial(RangeHandler, directory=sys.argv[1])
+with http.server.ThreadingHTTPServer(('127.0.0.1', 0), handler) as httpd:
+    with open(sys.argv[2], 'w') as port:
+        port.write(str(httpd.server_address[1]))
+    httpd.serve_forever()
+EOF
+python3 "$dir/server.py" "$dir" "$dir/port" &
+server=$!
+while [ ! -s "$dir/port" ]; do
+    kill -0 "$server"
+    sleep 0.1
+done
+
+# out of order, repeated and far apart times, so that the http mode seeks back and prefetches ahead
+printf '%s\n' 45000000 1000000 30000000 30000000 59000000 12520000 12560000 > "$dir/times.txt"
+
+"$extractor" -F text -I pread "$dir/$input" "$dir/times.txt" "$dir/pread.avi"
+"$extractor" -F text -I http "http://127.0.0.1:$(cat "$dir/port")/$input" "$dir/times.txt" "$dir/http.avi"
+cmp "$dir/pread.avi" "$dir/http.avi"
+echo "http and pread outputs are identical ($(wc -c < "$dir/http.avi") bytes)"
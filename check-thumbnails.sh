@@ -0,0 +1,82 @@
+#!/bin/sh
+# Extracts -W thumbnails from a generated 1080p H.264 source and compares them with the same frames downscaled
+# by ffmpeg on a single thread, with the bilinear swscale settings of the converter. Both sides are encoded at
+# the best quality, so seams or a stretch in the threaded downscale show up as a low PSNR. The converter keeps
+# the limited range of the source, as full-size frames do, so the thumbnails are also checked for the levels
+# of the full-size frames.
+#
+# Usage: check-thumbnails.sh FRAME_EXTRACTOR [WIDTH [MIN_PSNR]]
+set -e
+
+extractor=${1:?usage: $0 FRAME_EXTRACTOR [WIDTH [MIN_PSNR]]}
+width=${2:-320}
+min_psnr=${3:-45}
+height=$(( (width * 1080 + 960) / 1920 ))
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT INT TERM
+
+ffmpeg -v error -f lavfi -i testsrc2=size=1920x1080:rate=25:duration=10 -c:v libx264 -pix_fmt yuv420p -bf 0 \
+    "$dir/input.mp4"
+
+# frames 25, 63 and 175
+printf '%s\n' 1000000 2520000 7000000 > "$dir/times.txt"
+"$extractor" -F text -q 100 -W "$width" "$dir/input.mp4" "$dir/times.txt" "$dir/thumbs.avi"
+
+# the limited-range samples are relabelled as full range, not expanded
+ffmpeg -v error -threads 1 -filter_threads 1 -i "$dir/input.mp4" -fps_mode passthrough \
+    -vf "select='eq(n\,25)+eq(n\,63)+eq(n\,175)',scale=$width:$height:flags=bilinear,format=yuv420p,\
+setrange=full,format=yuvj420p" \
+    -c:v mjpeg -qmin 1 -qmax 1 -q:v 1 "$dir/reference.avi"
+
+ffmpeg -v error -i "$dir/thumbs.avi" -i "$dir/reference.avi" \
+    -lavfi "[0:v][1:v]psnr=stats_file=$dir/psnr.log" -f null -
+awk -v min="$min_psnr" -v expected=3 '
+    {
+        for (i = 1; i <= NF; i++)
+            if ($i ~ /^psnr_avg:/) {
+                psnr = substr($i, 10)
+                printf "frame %d: %s dB\n", NR, psnr
+                if (psnr != "inf" && psnr + 0 < min)
+                    low++
+            }
+    }
+    END {
+        if (NR != expected) {
+            printf "expected %d frames, got %d\n", expected, NR
+            exit 1
+        }
+        if (low > 0) {
+            printf "%d frames below %s dB\n", low, min
+            exit 1
+        }
+    }' "$dir/psnr.log"
+
+# a range expansion moves the dark and the bright levels by a dozen or more
+"$extractor" -F text -q 100 "$dir/input.mp4" "$dir/times.txt" "$dir/full.avi"
+for name in thumbs full; do
+    ffmpeg -v error -i "$dir/$name.avi" \
+        -vf "signalstats,metadata=print:file=$dir/$name.levels" -f null -
+done
+awk -F= -v expected=3 '
+    /signalstats\.Y(LOW|HIGH)=/ {
+        key = $1 " " ++seen[FILENAME, $1]
+        if (FILENAME == ARGV[1]) {
+            thumb[key] = $2
+        } else {
+            printf "%s: %s thumbnail, %s full size\n", key, thumb[key], $2
+            if ($2 - thumb[key] > 3 || thumb[key] - $2 > 3)
+                off++
+            checked++
+        }
+    }
+    END {
+        if (checked != expected * 2) {
+            printf "expected %d levels, got %d\n", expected * 2, checked
+            exit 1
+        }
+        if (off > 0) {
+            printf "%d levels differ from the full-size frames\n", off
+            exit 1
+        }
+    }' "$dir/thumbs.levels" "$dir/full.levels"
+echo "${width}x$height thumbnails match the single-threaded downscale and the levels of the full-size frames"
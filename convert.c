@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/error.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+#include "convert.h"
+
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT(6, 1, 100)
+#define HAVE_SWS_SCALE_FRAME 1
+#else
+#define HAVE_SWS_SCALE_FRAME 0
+#endif
+
+#define CONVERT_ALIGN 64
+#define CONVERT_FLAGS SWS_BILINEAR
+#define BAND_MIN_HEIGHT 64
+#define BAND_ALIGN 8
+
+struct band_job {
+    const struct convert_entry *entry;
+    const AVFrame *in;
+    AVFrame *out;
+};
+
+/*
+ * The JPEG variant of a planar YUV format, which has the same layout. Frames in either can go to the encoder
+ * as they are.
+ */
+enum AVPixelFormat convert_full_range(enum AVPixelFormat format) {
+    switch (format) {
+        case AV_PIX_FMT_YUV420P:
+            return AV_PIX_FMT_YUVJ420P;
+        case AV_PIX_FMT_YUV422P:
+            return AV_PIX_FMT_YUVJ422P;
+        case AV_PIX_FMT_YUV444P:
+            return AV_PIX_FMT_YUVJ444P;
+        case AV_PIX_FMT_YUV440P:
+            return AV_PIX_FMT_YUVJ440P;
+        default:
+            return format;
+    }
+}
+
+/*
+ * The MPEG variant of a JPEG format, see convert_full_range.
+ */
+static enum AVPixelFormat limited_range(enum AVPixelFormat format) {
+    switch (format) {
+        case AV_PIX_FMT_YUVJ420P:
+            return AV_PIX_FMT_YUV420P;
+        case AV_PIX_FMT_YUVJ422P:
+            return AV_PIX_FMT_YUV422P;
+        case AV_PIX_FMT_YUVJ444P:
+            return AV_PIX_FMT_YUV444P;
+        case AV_PIX_FMT_YUVJ440P:
+            return AV_PIX_FMT_YUV440P;
+        default:
+            return format;
+    }
+}
+
+/*
+ * Whether the samples of frame span the full range. Frames are scaled within their own range and then labelled
+ * with the encoder's format, as the extractor does with full-size frames that differ only in range, so that
+ * thumbnails keep the levels of the full-size frames.
+ */
+static int source_range(const AVFrame *frame) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    return frame->color_range == AVCOL_RANGE_JPEG || limited_range(frame->format) != frame->format ||
+           (desc != NULL && (desc->flags & AV_PIX_FMT_FLAG_RGB));
+}
+
+void convert_init(struct convert *convert, int width, int height, enum AVPixelFormat format, int threads) {
+    memset(convert, 0, sizeof(struct convert));
+    convert->width = width;
+    convert->height = height;
+    convert->format = format;
+    convert->threads = threads > 0 ? threads : av_cpu_count();
+    for (int i = 0; i < CONVERT_CACHE_SIZE; i++)
+        convert->entries[i].src_format = AV_PIX_FMT_NONE;
+    band_pool_init(&convert->workers, HAVE_SWS_SCALE_FRAME ? 1 : convert->threads);
+}
+
+int convert_needed(const struct convert *convert, const AVFrame *frame) {
+    return frame->width != convert->width || frame->height != convert->height ||
+           convert_full_range(frame->format) != convert_full_range(convert->format);
+}
+
+static void free_entry(struct convert_entry *entry) {
+    for (int b = 0; b < entry->band_count; b++) {
+        sws_freeContext(entry->bands[b].ctx);
+        entry->bands[b].ctx = NULL;
+    }
+    entry->band_count = 0;
+    entry->src_format = AV_PIX_FMT_NONE;
+}
+
+#if HAVE_SWS_SCALE_FRAME
+
+/*
+ * A context for the whole frame that libswscale slices over convert->threads threads of its own.
+ */
+static struct SwsContext *frame_context(const struct convert *convert, const AVFrame *frame, int range) {
+    int ret;
+    struct SwsContext *ctx = sws_alloc_context();
+    if (ctx == NULL)
+        return NULL;
+    if ((ret = av_opt_set_int(ctx, "srcw", frame->width, 0)) < 0 ||
+        (ret = av_opt_set_int(ctx, "srch", frame->height, 0)) < 0 ||
+        (ret = av_opt_set_int(ctx, "src_format", limited_range(frame->format), 0)) < 0 ||
+        (ret = av_opt_set_int(ctx, "src_range", range, 0)) < 0 ||
+        (ret = av_opt_set_int(ctx, "dstw", convert->width, 0)) < 0 ||
+        (ret = av_opt_set_int(ctx, "dsth", convert->height, 0)) < 0 ||
+        (ret = av_opt_set_int(ctx, "dst_format", limited_range(convert->format), 0)) < 0 ||
+        (ret = av_opt_set_int(ctx, "dst_range", range, 0)) < 0 ||
+        (ret = av_opt_set_int(ctx, "sws_flags", CONVERT_FLAGS, 0)) < 0 ||
+        (ret = av_opt_set_int(ctx, "threads", convert->threads, 0)) < 0 ||
+        (ret = sws_init_context(ctx, NULL, NULL)) < 0) {
+        fprintf(stderr, "Failed to set up the conversion: %s\n", av_err2str(ret));
+        sws_freeContext(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+#else
+
+static int chroma_rows(enum AVPixelFormat format) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    return desc != NULL ? 1 << desc->log2_chroma_h : 1;
+}
+
+/*
+ * Without threads in libswscale, frames that keep their size are split into bands of whole dither periods,
+ * which convert row for row as the whole frame would. Anything that scales, or resamples the chroma vertically,
+ * gets a single band so that every output row is interpolated from the same source rows.
+ */
+static int band_count(const struct convert *convert, const AVFrame *frame) {
+    int units = (frame->height + BAND_ALIGN - 1) / BAND_ALIGN;
+    if (frame->width != convert->width || frame->height != convert->height ||
+        chroma_rows(frame->format) != chroma_rows(convert->format))
+        return 1;
+    return FFMAX(1, FFMIN(FFMIN(FFMIN(convert->threads, frame->height / BAND_MIN_HEIGHT), CONVERT_MAX_BANDS),
+                          units));
+}
+
+static void convert_band(void *arg, int index, int count) {
+    struct band_job *job = arg;
+    const struct convert_band *band = &job->entry->bands[index];
+    const AVPixFmtDescriptor *src_desc = av_pix_fmt_desc_get(job->in->format);
+    const AVPixFmtDescriptor *dst_desc = av_pix_fmt_desc_get(job->out->format);
+    const uint8_t *src[4] = {NULL};
+    uint8_t *dst[4] = {NULL};
+
+    (void) count;
+    for (int p = 0; p < 4 && job->in->data[p] != NULL; p++) {
+        int shift = (p == 1 || p == 2) ? src_desc->log2_chroma_h : 0;
+        if (p == 1 && (src_desc->flags & AV_PIX_FMT_FLAG_PAL))
+            src[p] = job->in->data[p];
+        else
+            src[p] = job->in->data[p] + (band->start >> shift) * job->in->linesize[p];
+    }
+    for (int p = 0; p < 4 && job->out->data[p] != NULL; p++) {
+        int shift = (p == 1 || p == 2) ? dst_desc->log2_chroma_h : 0;
+        dst[p] = job->out->data[p] + (band->start >> shift) * job->out->linesize[p];
+    }
+    sws_scale(band->ctx, src, job->in->linesize, 0, band->height, dst, job->out->linesize);
+}
+
+#endif
+
+/*
+ * Sets up the scaler of an entry for the input format, range and size of frame.
+ */
+static int configure(struct convert *convert, struct convert_entry *entry, const AVFrame *frame) {
+    if (!sws_isSupportedInput(frame->format) || !sws_isSupportedOutput(convert->format)) {
+        fprintf(stderr, "Unsupported conversion from %s to %s\n", av_get_pix_fmt_name(frame->format),
+                av_get_pix_fmt_name(convert->format));
+        return AVERROR(ENOSYS);
+    }
+    int range = source_range(frame);
+    free_entry(entry);
+#if HAVE_SWS_SCALE_FRAME
+    entry->bands[0].start = 0;
+    entry->bands[0].height = frame->height;
+    if ((entry->bands[0].ctx = frame_context(convert, frame, range)) == NULL)
+        return AVERROR(ENOMEM);
+    entry->band_count = 1;
+#else
+    int count = band_count(convert, frame), units = (frame->height + BAND_ALIGN - 1) / BAND_ALIGN;
+    for (int b = 0; b < count; b++) {
+        struct convert_band *band = &entry->bands[b];
+        int end = count == 1 ? frame->height : FFMIN(frame->height, units * (b + 1) / count * BAND_ALIGN);
+        band->start = b > 0 ? entry->bands[b - 1].start + entry->bands[b - 1].height : 0;
+        band->height = end - band->start;
+        band->ctx = sws_getContext(frame->width, band->height, limited_range(frame->format), convert->width,
+                                   count == 1 ? convert->height : band->height, limited_range(convert->format),
+                                   CONVERT_FLAGS, NULL, NULL, NULL);
+        entry->band_count = b + 1;
+        if (band->ctx == NULL) {
+            free_entry(entry);
+            return AVERROR(ENOMEM);
+        }
+        sws_setColorspaceDetails(band->ctx, sws_getCoefficients(SWS_CS_DEFAULT), range,
+                                 sws_getCoefficients(SWS_CS_DEFAULT), range, 0, 1 << 16, 1 << 16);
+    }
+#endif
+    entry->src_width = frame->width;
+    entry->src_height = frame->height;
+    entry->src_format = frame->format;
+    entry->src_range = range;
+    return 0;
+}
+
+/*
+ * The entry for the input format, range and size of frame, set up in place of the least recently used one on a miss.
+ */
+static int find_entry(struct convert *convert, const AVFrame *frame, struct convert_entry **entry) {
+    int ret;
+    struct convert_entry *found = &convert->entries[0];
+    for (int i = 0; i < CONVERT_CACHE_SIZE; i++) {
+        struct convert_entry *candidate = &convert->entries[i];
+        if (candidate->src_width == frame->width && candidate->src_height == frame->height &&
+            candidate->src_format == frame->format && candidate->src_range == source_range(frame)) {
+            found = candidate;
+            break;
+        }
+        if (candidate->last_used < found->last_used)
+            found = candidate;
+    }
+    if (found->src_format != frame->format || found->src_width != frame->width ||
+        found->src_height != frame->height || found->src_range != source_range(frame)) {
+        if ((ret = configure(convert, found, frame)) < 0)
+            return ret;
+    }
+    found->last_used = ++convert->uses;
+    *entry = found;
+    return 0;
+}
+
+/*
+ * Writes the converted copy of `in` into `out`, whose buffer comes from the converter's pool.
+ */
+int convert_apply(struct convert *convert, const AVFrame *in, AVFrame *out) {
+    int ret, size;
+    struct convert_entry *entry;
+
+    if ((ret = find_entry(convert, in, &entry)) < 0)
+        return ret;
+    if (convert->pool == NULL) {
+        if ((size = av_image_get_buffer_size(convert->format, convert->width, convert->height, CONVERT_ALIGN)) < 0)
+            return size;
+        if ((convert->pool = av_buffer_pool_init(size + AV_INPUT_BUFFER_PADDING_SIZE, av_buffer_alloc)) == NULL)
+            return AVERROR(ENOMEM);
+    }
+
+    av_frame_unref(out);
+    out->format = convert->format;
+    out->width = convert->width;
+    out->height = convert->height;
+    if ((out->buf[0] = av_buffer_pool_get(convert->pool)) == NULL)
+        return AVERROR(ENOMEM);
+    if ((ret = av_image_fill_arrays(out->data, out->linesize, out->buf[0]->data, convert->format, convert->width,
+                                    convert->height, CONVERT_ALIGN)) < 0)
+        return ret;
+    out->extended_data = out->data;
+    if ((ret = av_frame_copy_props(out, in)) < 0)
+        return ret;
+
+#if HAVE_SWS_SCALE_FRAME
+    if ((ret = sws_scale_frame(entry->bands[0].ctx, out, in)) < 0)
+        return ret;
+#else
+    struct band_job job = {entry, in, out};
+    band_pool_run(&convert->workers, convert_band, &job, entry->band_count);
+#endif
+    return 0;
+}
+
+void convert_uninit(struct convert *convert) {
+    for (int i = 0; i < CONVERT_CACHE_SIZE; i++)
+        free_entry(&convert->entries[i]);
+    band_pool_uninit(&convert->workers);
+    av_buffer_pool_uninit(&convert->pool);
+}
@@ -0,0 +1,56 @@
+#ifndef FRAME_EXTRACTOR_CONVERT_H
+#define FRAME_EXTRACTOR_CONVERT_H
+
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include "band_pool.h"
+
+#define CONVERT_MAX_BANDS 64
+#define CONVERT_CACHE_SIZE 4
+
+struct convert_band {
+    struct SwsContext *ctx;
+    int start;
+    int height;
+};
+
+/*
+ * The scaler set up for one input format, range and size: a single context for the whole frame, or bands of rows
+ * that are converted without scaling.
+ */
+struct convert_entry {
+    int src_width;
+    int src_height;
+    int src_format;
+    int src_range;
+    uint64_t last_used;
+    int band_count;
+    struct convert_band bands[CONVERT_MAX_BANDS];
+};
+
+/*
+ * Converts frames to the encoder's pixel format and size with libswscale. A frame is always scaled with one
+ * geometry: where libswscale can slice a frame over its own threads, by a single threaded context, otherwise
+ * by a single context, or in bands on the band pool when only the pixel format changes. Samples keep their range,
+ * full or limited, whatever the range of the encoder's format. The scalers of the last CONVERT_CACHE_SIZE input
+ * formats and sizes are kept.
+ */
+struct convert {
+    int width;
+    int height;
+    enum AVPixelFormat format;
+    int threads;
+    uint64_t uses;
+    struct convert_entry entries[CONVERT_CACHE_SIZE];
+    struct band_pool workers;
+    AVBufferPool *pool;
+};
+
+enum AVPixelFormat convert_full_range(enum AVPixelFormat format);
+void convert_init(struct convert *convert, int width, int height, enum AVPixelFormat format, int threads);
+int convert_needed(const struct convert *convert, const AVFrame *frame);
+int convert_apply(struct convert *convert, const AVFrame *in, AVFrame *out);
+void convert_uninit(struct convert *convert);
+
+#endif //FRAME_EXTRACTOR_CONVERT_H
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/error.h>
+#include "encoder_pool.h"
+
+int encoder_pool_init(struct encoder_pool *pool, unsigned int capacity) {
+    memset(pool, 0, sizeof(struct encoder_pool));
+    if ((pool->entries = calloc(capacity, sizeof(struct encoder_pool_entry))) == NULL)
+        return AVERROR(ENOMEM);
+    pool->capacity = capacity;
+    pthread_mutex_init(&pool->lock, NULL);
+    return 0;
+}
+
+/*
+ * Takes an opened encoder matching the request out of the pool, the most recently returned first.
+ * threads is the requested thread count, as the encoder may have changed its own on opening. The time base and
+ * aspect ratio are part of the match since an opened encoder must not be changed.
+ * Returns NULL if there is none, and the caller opens a new one.
+ */
+AVCodecContext *encoder_pool_take(struct encoder_pool *pool, const AVCodec *encoder, int width, int height,
+                                  enum AVPixelFormat format, AVRational time_base, AVRational sample_aspect_ratio,
+                                  int qmax, unsigned int threads) {
+    AVCodecContext *codec_ctx = NULL;
+    pthread_mutex_lock(&pool->lock);
+    for (unsigned int i = pool->count; i-- > 0;) {
+        AVCodecContext *candidate = pool->entries[i].codec_ctx;
+        if (candidate->codec != encoder || candidate->width != width || candidate->height != height ||
+            candidate->pix_fmt != format || av_cmp_q(candidate->time_base, time_base) != 0 ||
+            av_cmp_q(candidate->sample_aspect_ratio, sample_aspect_ratio) != 0 || candidate->qmax != qmax ||
+            pool->entries[i].threads != threads)
+            continue;
+        codec_ctx = candidate;
+        memmove(&pool->entries[i], &pool->entries[i + 1],
+                (pool->count - i - 1) * sizeof(struct encoder_pool_entry));
+        pool->count--;
+        break;
+    }
+    if (codec_ctx != NULL)
+        pool->hits++;
+    else
+        pool->misses++;
+    pthread_mutex_unlock(&pool->lock);
+    return codec_ctx;
+}
+
+/*
+ * Returns an encoder to the pool, or frees it if it was not opened or has delay. A full pool frees its oldest
+ * encoder. *codec_ctx is set to NULL either way.
+ */
+void encoder_pool_give(struct encoder_pool *pool, AVCodecContext **codec_ctx, unsigned int threads) {
+    AVCodecContext *evicted = NULL;
+    if (*codec_ctx == NULL)
+        return;
+    if (!avcodec_is_open(*codec_ctx) || ((*codec_ctx)->codec->capabilities & AV_CODEC_CAP_DELAY) ||
+        pool->capacity == 0) {
+        avcodec_free_context(codec_ctx);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count == pool->capacity) {
+        evicted = pool->entries[0].codec_ctx;
+        memmove(&pool->entries[0], &pool->entries[1], (pool->count - 1) * sizeof(struct encoder_pool_entry));
+        pool->count--;
+    }
+    pool->entries[pool->count].codec_ctx = *codec_ctx;
+    pool->entries[pool->count].threads = threads;
+    pool->count++;
+    pthread_mutex_unlock(&pool->lock);
+    *codec_ctx = NULL;
+    avcodec_free_context(&evicted);
+}
+
+void encoder_pool_free(struct encoder_pool *pool) {
+    for (unsigned int i = 0; i < pool->count; i++)
+        avcodec_free_context(&pool->entries[i].codec_ctx);
+    free(pool->entries);
+    pool->entries = NULL;
+    pool->count = pool->capacity = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,34 @@
+#ifndef FRAME_EXTRACTOR_ENCODER_POOL_H
+#define FRAME_EXTRACTOR_ENCODER_POOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <libavcodec/avcodec.h>
+
+/*
+ * Opened encoders left by finished extractions, handed to the next extraction that encodes the same geometry
+ * with the same settings, so that a run of short jobs does not set up an encoder and its slice threads for
+ * each job. Only encoders without delay are kept: they hold no frames between calls and need no draining.
+ */
+struct encoder_pool_entry {
+    AVCodecContext *codec_ctx;
+    unsigned int threads;
+};
+
+struct encoder_pool {
+    pthread_mutex_t lock;
+    struct encoder_pool_entry *entries;
+    unsigned int count;
+    unsigned int capacity;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+int encoder_pool_init(struct encoder_pool *pool, unsigned int capacity);
+AVCodecContext *encoder_pool_take(struct encoder_pool *pool, const AVCodec *encoder, int width, int height,
+                                  enum AVPixelFormat format, AVRational time_base, AVRational sample_aspect_ratio,
+                                  int qmax, unsigned int threads);
+void encoder_pool_give(struct encoder_pool *pool, AVCodecContext **codec_ctx, unsigned int threads);
+void encoder_pool_free(struct encoder_pool *pool);
+
+#endif //FRAME_EXTRACTOR_ENCODER_POOL_H
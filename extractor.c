@@ -0,0 +1,1243 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <libavformat/avformat.h>
+#include <libavutil/cpu.h>
+#include "convert.h"
+#include "extractor.h"
+#include "frame_cache.h"
+#include "index.h"
+#include "lens.h"
+#include "plan.h"
+#include "queue.h"
+#include "source.h"
+#include "stats.h"
+
+#define QUEUE_CAPACITY 8
+#define REUSE_CAPACITY 32
+#define FILTERED_CAPACITY 4
+#define PREFETCH_GOPS 4
+#define REORDER_WINDOW 16
+#define LENSCORRECTION_K2 (-0.012)
+
+struct pending {
+    AVFrame *frame;
+    AVPacket *packet;
+    int resolved;
+};
+
+struct worker {
+    pthread_t thread;
+    struct extractor *ex;
+    struct source *src;
+    struct source own_src;
+    AVFrame *prev_frame;
+    int64_t last_ts;
+    int ret;
+};
+
+struct extractor {
+    struct extractor_options options;
+    const char *filename;
+    volatile int stop;
+    int64_t tolerance;
+    int copy_packets;
+    int cache_frames;
+
+    struct source src;
+    struct index index;
+    struct plan plan;
+    struct frame_cache frame_cache;
+
+    AVCodecContext *codec_ctx;
+    AVCodecParameters *codecpar;
+    struct lens lens;
+    struct convert convert;
+    int converting;
+    int filtering;
+
+    struct pending *pending;
+    unsigned int pending_count;
+    unsigned int pending_next;
+    pthread_mutex_t pending_lock;
+    pthread_cond_t pending_cond;
+
+    struct worker *workers;
+    unsigned int *batches;
+    unsigned int batch_count;
+    unsigned int batch_next;
+    unsigned int workers_running;
+    unsigned int workers_busy;
+    int windows_done;
+    int error;
+    uint64_t emitted;
+    uint64_t delivered;
+
+    struct queue filter_queue;
+    struct queue encode_queue;
+    struct queue output_queue;
+    pthread_t stages[3];
+    unsigned int stage_count;
+
+    pthread_mutex_t reuse_lock;
+    AVPacket *reuse_packets[REUSE_CAPACITY];
+    int64_t reuse_packet_pts[REUSE_CAPACITY];
+    unsigned int reuse_packet_next;
+    AVFrame *filtered[FILTERED_CAPACITY];
+    unsigned int filtered_next;
+    uint64_t reused;
+    struct stats stats;
+};
+
+void extractor_default_options(struct extractor_options *options) {
+    memset(options, 0, sizeof(*options));
+    options->quality = 70;
+    options->jobs = 1;
+    options->decoder_thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    options->lenscorrection_k1 = -0.125;
+}
+
+/*
+ * Keeps the source format, or its JPEG variant, if the encoder takes it, so that the frames need no conversion.
+ */
+static enum AVPixelFormat encoder_format(const AVCodec *encoder, enum AVPixelFormat src_format) {
+    if (!encoder->pix_fmts)
+        return src_format;
+    for (const enum AVPixelFormat *format = encoder->pix_fmts; *format != AV_PIX_FMT_NONE; format++) {
+        if (*format == convert_full_range(src_format))
+            return *format;
+    }
+    return encoder->pix_fmts[0];
+}
+
+/*
+ * The requested output size, where a missing side follows the aspect ratio of the source.
+ */
+static void output_size(const struct extractor *ex, int *width, int *height) {
+    int src_width = ex->src.codec_ctx->width, src_height = ex->src.codec_ctx->height;
+    *width = ex->options.width;
+    *height = ex->options.height;
+    if (*width == 0 && *height == 0) {
+        *width = src_width;
+        *height = src_height;
+    } else if (*width == 0) {
+        *width = src_height > 0 ? (int) FFMAX(1, av_rescale(*height, src_width, src_height)) : *height;
+    } else if (*height == 0) {
+        *height = src_width > 0 ? (int) FFMAX(1, av_rescale(*width, src_height, src_width)) : *width;
+    }
+}
+
+/*
+ * Opens the encoder, or takes an opened one of the same geometry and settings from options.encoders.
+ * Only the per-picture fields of a reused encoder are updated.
+ */
+static int open_encoder(struct extractor *ex, const char *codec) {
+    int ret = 0;
+    int width, height, qmax = 129 - (int) round(ex->options.quality * 1.28);
+    enum AVPixelFormat format;
+    AVCodec *encoder = avcodec_find_encoder_by_name(codec);
+    if (!encoder) {
+        av_log(NULL, AV_LOG_FATAL, "Necessary encoder not found\n");
+        return AVERROR_INVALIDDATA;
+    }
+    output_size(ex, &width, &height);
+    format = encoder_format(encoder, ex->src.codec_ctx->pix_fmt);
+    if (ex->options.encoders != NULL)
+        ex->codec_ctx = encoder_pool_take(ex->options.encoders, encoder, width, height, format,
+                                          ex->src.stream->time_base, ex->src.codec_ctx->sample_aspect_ratio, qmax,
+                                          ex->options.encoder_threads);
+    if (ex->codec_ctx == NULL) {
+        ex->codec_ctx = avcodec_alloc_context3(encoder);
+        if (!ex->codec_ctx) {
+            fprintf(stderr, "Failed to allocate the output codec\n");
+            return AVERROR(ENOMEM);
+        }
+        ex->codec_ctx->qmax = qmax;
+        ex->codec_ctx->qmin = qmax;
+        ex->codec_ctx->width = width;
+        ex->codec_ctx->height = height;
+        ex->codec_ctx->sample_aspect_ratio = ex->src.codec_ctx->sample_aspect_ratio;
+        ex->codec_ctx->pix_fmt = format;
+        ex->codec_ctx->time_base = ex->src.stream->time_base;
+        ex->codec_ctx->thread_count = ex->options.encoder_threads;
+        ex->codec_ctx->thread_type = FF_THREAD_SLICE;
+
+        if ((ret = avcodec_open2(ex->codec_ctx, encoder, NULL)) != 0) {
+            fprintf(stderr, "Failed to open output codec: %s\n", av_err2str(ret));
+            return ret;
+        }
+    }
+    if ((ex->codecpar = avcodec_parameters_alloc()) == NULL)
+        return AVERROR(ENOMEM);
+    return avcodec_parameters_from_context(ex->codecpar, ex->codec_ctx);
+}
+
+/*
+ * Takes the output stream parameters from the source, whose packets are passed on as they are.
+ */
+static int open_copy(struct extractor *ex) {
+    int ret;
+    if ((ex->codecpar = avcodec_parameters_alloc()) == NULL)
+        return AVERROR(ENOMEM);
+    if ((ret = avcodec_parameters_copy(ex->codecpar, ex->src.stream->codecpar)) < 0)
+        return ret;
+    ex->codecpar->codec_tag = 0;
+    return 0;
+}
+
+static void free_frame_item(void *item) {
+    AVFrame *frame = item;
+    av_frame_free(&frame);
+}
+
+static void free_packet_item(void *item) {
+    AVPacket *packet = item;
+    av_packet_free(&packet);
+}
+
+/*
+ * Stops the pipeline after a stage failure: upstream pushes into `in` fail and downstream drains `out`.
+ */
+static void *stage_failed(struct extractor *ex, int ret, struct queue *in, struct queue *out) {
+    pthread_mutex_lock(&ex->pending_lock);
+    if (ex->error == 0)
+        ex->error = ret;
+    pthread_cond_broadcast(&ex->pending_cond);
+    pthread_mutex_unlock(&ex->pending_lock);
+    queue_abort(in);
+    if (out != NULL)
+        queue_close(out);
+    return NULL;
+}
+
+/*
+ * Replaces *frame with its pixel format conversion, or with its lens correction. The frame is freed on failure.
+ */
+static int filter_frame(struct extractor *ex, AVFrame **frame, int lens) {
+    int ret;
+    int64_t start;
+    AVFrame *filtered = av_frame_alloc();
+    if (filtered == NULL) {
+        av_frame_free(frame);
+        return AVERROR(ENOMEM);
+    }
+    start = stats_start(&ex->stats);
+    if (lens)
+        ret = lens_apply(&ex->lens, *frame, filtered);
+    else
+        ret = convert_apply(&ex->convert, *frame, filtered);
+    stats_stop(&ex->stats, STATS_FILTER, start);
+    av_frame_free(frame);
+    if (ret < 0) {
+        av_frame_free(&filtered);
+        return ret;
+    }
+    *frame = filtered;
+    return 0;
+}
+
+/*
+ * Keeps a reference to the last REUSE_CAPACITY encoded packets, each with the pts of the source frame it was
+ * encoded from. The filter stage looks them up as well, hence the lock.
+ */
+static int keep_packet(struct extractor *ex, const AVPacket *packet, int64_t pts) {
+    AVPacket *kept = av_packet_clone(packet);
+    if (kept == NULL)
+        return AVERROR(ENOMEM);
+    pthread_mutex_lock(&ex->reuse_lock);
+    av_packet_free(&ex->reuse_packets[ex->reuse_packet_next]);
+    ex->reuse_packets[ex->reuse_packet_next] = kept;
+    ex->reuse_packet_pts[ex->reuse_packet_next] = pts;
+    ex->reuse_packet_next = (ex->reuse_packet_next + 1) % REUSE_CAPACITY;
+    pthread_mutex_unlock(&ex->reuse_lock);
+    return 0;
+}
+
+/*
+ * Returns a new reference to the packet kept for the source frame at pts, or NULL if there is none.
+ */
+static AVPacket *find_packet(struct extractor *ex, int64_t pts) {
+    AVPacket *packet = NULL;
+    if (pts == AV_NOPTS_VALUE)
+        return NULL;
+    pthread_mutex_lock(&ex->reuse_lock);
+    for (unsigned int i = 0; i < REUSE_CAPACITY && packet == NULL; i++) {
+        if (ex->reuse_packets[i] != NULL && ex->reuse_packet_pts[i] == pts)
+            packet = av_packet_clone(ex->reuse_packets[i]);
+    }
+    pthread_mutex_unlock(&ex->reuse_lock);
+    return packet;
+}
+
+static void free_carried_packet(void *opaque, uint8_t *data) {
+    AVPacket *packet = (AVPacket *) data;
+    (void) opaque;
+    av_packet_free(&packet);
+}
+
+/*
+ * Spares the filters a frame whose source frame went through them recently. If its packet is already kept,
+ * the frame is replaced by an empty one that carries the packet to the encode stage. Otherwise, if one of the
+ * last FILTERED_CAPACITY filtered frames has its pts, it is replaced by a reference to that frame.
+ * Returns 1 if the frame was replaced.
+ */
+static int reuse_filtered(struct extractor *ex, AVFrame **frame) {
+    int64_t pts = (*frame)->pts;
+    AVFrame *reused = NULL;
+    AVPacket *packet;
+
+    if (pts == AV_NOPTS_VALUE)
+        return 0;
+    if ((packet = find_packet(ex, pts)) != NULL) {
+        if ((reused = av_frame_alloc()) == NULL ||
+            (reused->opaque_ref = av_buffer_create((uint8_t *) packet, 0, free_carried_packet, NULL, 0)) == NULL) {
+            av_packet_free(&packet);
+            av_frame_free(&reused);
+            return 0;
+        }
+        reused->pts = pts;
+    } else {
+        for (unsigned int i = 0; i < FILTERED_CAPACITY && reused == NULL; i++) {
+            if (ex->filtered[i] != NULL && ex->filtered[i]->pts == pts)
+                reused = av_frame_clone(ex->filtered[i]);
+        }
+        if (reused == NULL)
+            return 0;
+    }
+    av_frame_free(frame);
+    *frame = reused;
+    return 1;
+}
+
+static void keep_filtered(struct extractor *ex, const AVFrame *frame) {
+    if (frame->pts == AV_NOPTS_VALUE)
+        return;
+    av_frame_free(&ex->filtered[ex->filtered_next]);
+    ex->filtered[ex->filtered_next] = av_frame_clone(frame);
+    ex->filtered_next = (ex->filtered_next + 1) % FILTERED_CAPACITY;
+}
+
+static void free_filtered(struct extractor *ex) {
+    for (unsigned int i = 0; i < FILTERED_CAPACITY; i++)
+        av_frame_free(&ex->filtered[i]);
+}
+
+/*
+ * Converts the frames the encoder cannot take as they are, then applies the lens correction.
+ * Frames that repeat a recent source frame are not filtered again, see reuse_filtered.
+ */
+static void *filter_main(void *arg) {
+    int ret;
+    AVFrame *frame;
+    struct extractor *ex = arg;
+
+    while ((frame = queue_pop(&ex->filter_queue)) != NULL) {
+        ret = 0;
+        if (reuse_filtered(ex, &frame)) {
+            if (queue_push(&ex->encode_queue, frame) < 0)
+                return stage_failed(ex, AVERROR_EXIT, &ex->filter_queue, NULL);
+            continue;
+        }
+        if (ex->converting && convert_needed(&ex->convert, frame)) {
+            if ((ret = filter_frame(ex, &frame, 0)) < 0)
+                fprintf(stderr, "Pixel format conversion failed: %s\n", av_err2str(ret));
+        }
+        if (ret == 0 && ex->options.lenscorrection) {
+            if ((ret = filter_frame(ex, &frame, 1)) < 0)
+                fprintf(stderr, "Lens correction failed: %s\n", av_err2str(ret));
+        }
+        if (ret < 0)
+            return stage_failed(ex, ret, &ex->filter_queue, &ex->encode_queue);
+        keep_filtered(ex, frame);
+        if (queue_push(&ex->encode_queue, frame) < 0)
+            return stage_failed(ex, AVERROR_EXIT, &ex->filter_queue, NULL);
+    }
+    queue_close(&ex->encode_queue);
+    return NULL;
+}
+
+/*
+ * Answers a frame whose source frame was encoded recently with a new reference to its packet, either the one
+ * carried by an empty frame from the filter stage or the one kept for its pts.
+ * Returns 1 if the packet was repeated, 0 if the frame has to be encoded, or a negative error code.
+ */
+static int repeat_packet(struct extractor *ex, const AVFrame *frame) {
+    int ret;
+    AVPacket *packet;
+    if (frame->buf[0] == NULL && frame->opaque_ref != NULL)
+        packet = av_packet_clone((const AVPacket *) frame->opaque_ref->data);
+    else
+        packet = find_packet(ex, frame->pts);
+    if (packet == NULL)
+        return frame->buf[0] != NULL ? 0 : AVERROR(ENOMEM);
+    ex->reused++;
+    return (ret = queue_push(&ex->output_queue, packet)) < 0 ? ret : 1;
+}
+
+/*
+ * Passes the encoded packets on, keeping them for the frame at pts. An encoder with delay may return the packets
+ * of earlier frames, so theirs are kept for their own pts, which the encoder copies from the frame.
+ */
+static int receive_packets(struct extractor *ex, int64_t pts) {
+    int ret;
+    for (;;) {
+        AVPacket *packet = av_packet_alloc();
+        if (packet == NULL)
+            return AVERROR(ENOMEM);
+        ret = avcodec_receive_packet(ex->codec_ctx, packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            av_packet_free(&packet);
+            return 0;
+        } else if (ret < 0) {
+            fprintf(stderr, "Error during encoding: %s\n", av_err2str(ret));
+            av_packet_free(&packet);
+            return ret;
+        }
+        if ((ret = keep_packet(ex, packet, pts != AV_NOPTS_VALUE ? pts : packet->pts)) < 0) {
+            av_packet_free(&packet);
+            return ret;
+        }
+        if ((ret = queue_push(&ex->output_queue, packet)) < 0)
+            return ret;
+    }
+}
+
+/*
+ * Encodes the filtered frames. An encoder without delay has nothing left to drain at the end, and is not
+ * drained, which keeps it usable for another extraction.
+ */
+static void *encode_main(void *arg) {
+    int ret;
+    int64_t start, pts;
+    AVFrame *frame;
+    struct extractor *ex = arg;
+
+    while ((frame = queue_pop(&ex->encode_queue)) != NULL) {
+        if ((ret = repeat_packet(ex, frame)) != 0) {
+            av_frame_free(&frame);
+            if (ret < 0)
+                return stage_failed(ex, ret, &ex->encode_queue, &ex->output_queue);
+            continue;
+        }
+        pts = ex->codec_ctx->codec->capabilities & AV_CODEC_CAP_DELAY ? AV_NOPTS_VALUE : frame->pts;
+        if (convert_full_range(frame->format) == convert_full_range(ex->codec_ctx->pix_fmt))
+            frame->format = ex->codec_ctx->pix_fmt;
+        start = stats_start(&ex->stats);
+        ret = avcodec_send_frame(ex->codec_ctx, frame);
+        av_frame_free(&frame);
+        if (ret != 0) {
+            fprintf(stderr, "Failed to send a frame for encoding: %s\n", av_err2str(ret));
+            return stage_failed(ex, ret, &ex->encode_queue, &ex->output_queue);
+        }
+        ret = receive_packets(ex, pts);
+        stats_stop(&ex->stats, STATS_ENCODE, start);
+        if (ret < 0)
+            return stage_failed(ex, ret, &ex->encode_queue, &ex->output_queue);
+    }
+    ret = 0;
+    if ((ex->codec_ctx->codec->capabilities & AV_CODEC_CAP_DELAY) &&
+        (ret = avcodec_send_frame(ex->codec_ctx, NULL)) == 0)
+        ret = receive_packets(ex, AV_NOPTS_VALUE);
+    if (ret < 0 && ret != AVERROR_EOF)
+        return stage_failed(ex, ret, &ex->encode_queue, &ex->output_queue);
+    queue_close(&ex->output_queue);
+    return NULL;
+}
+
+/*
+ * Hands the encoded packets to the caller. Packets carry the source timestamp of their frame as pts.
+ */
+static void *output_main(void *arg) {
+    int ret;
+    int64_t start;
+    AVPacket *packet;
+    struct extractor *ex = arg;
+
+    while ((packet = queue_pop(&ex->output_queue)) != NULL) {
+        packet->pts = packet->dts = av_rescale_q(packet->pts, ex->src.stream->time_base, AV_TIME_BASE_Q);
+        packet->duration = 0;
+        packet->pos = -1;
+        packet->stream_index = 0;
+        start = stats_start(&ex->stats);
+        ret = ex->options.packet_cb(ex->options.opaque, packet);
+        stats_stop(&ex->stats, STATS_MUX, start);
+        av_packet_free(&packet);
+        if (ret < 0)
+            return stage_failed(ex, ret, &ex->output_queue, NULL);
+        pthread_mutex_lock(&ex->pending_lock);
+        ex->delivered++;
+        pthread_cond_broadcast(&ex->pending_cond);
+        pthread_mutex_unlock(&ex->pending_lock);
+    }
+    return NULL;
+}
+
+static int resolve_request(struct extractor *ex, const struct plan_entry *entry, const AVFrame *frame,
+                           const AVPacket *packet, const struct source *from) {
+    AVFrame *frame_clone = NULL;
+    AVPacket *packet_clone = NULL;
+    if (frame != NULL) {
+        if ((frame_clone = av_frame_clone(frame)) == NULL) {
+            fprintf(stderr, "Could not allocate frame\n");
+            return AVERROR(ENOMEM);
+        }
+    } else if (packet != NULL) {
+        if ((packet_clone = av_packet_clone(packet)) == NULL) {
+            fprintf(stderr, "Could not allocate packet\n");
+            return AVERROR(ENOMEM);
+        }
+    } else {
+        fprintf(stderr, "No frame found for %.3f\n", entry->ts * av_q2d(from->stream->time_base));
+    }
+    pthread_mutex_lock(&ex->pending_lock);
+    ex->pending[entry->index].frame = frame_clone;
+    ex->pending[entry->index].packet = packet_clone;
+    ex->pending[entry->index].resolved = 1;
+    pthread_cond_broadcast(&ex->pending_cond);
+    pthread_mutex_unlock(&ex->pending_lock);
+    return 0;
+}
+
+static struct queue *pipeline_input(struct extractor *ex) {
+    return ex->copy_packets ? &ex->output_queue : ex->filtering ? &ex->filter_queue : &ex->encode_queue;
+}
+
+/*
+ * Feeds the resolved frames to the output pipeline in the original request order as they become available,
+ * until every request is emitted or all workers are gone.
+ */
+static int emit_pending(struct extractor *ex) {
+    int ret = 0;
+    struct queue *out = pipeline_input(ex);
+    pthread_mutex_lock(&ex->pending_lock);
+    while (ex->pending_next < ex->pending_count && ex->error == 0) {
+        while (!ex->pending[ex->pending_next].resolved && ex->workers_running > 0 && ex->error == 0)
+            pthread_cond_wait(&ex->pending_cond, &ex->pending_lock);
+        if (!ex->pending[ex->pending_next].resolved || ex->error != 0)
+            break;
+        AVFrame *frame = ex->pending[ex->pending_next].frame;
+        AVPacket *packet = ex->pending[ex->pending_next].packet;
+        ex->pending[ex->pending_next].frame = NULL;
+        ex->pending[ex->pending_next].packet = NULL;
+        pthread_mutex_unlock(&ex->pending_lock);
+        if (frame != NULL) {
+            frame->pts = frame->best_effort_timestamp;
+            ret = queue_push(out, frame);
+        } else if (packet != NULL) {
+            if (packet->pts == AV_NOPTS_VALUE)
+                packet->pts = packet->dts;
+            ret = queue_push(out, packet);
+        }
+        if (ret < 0) {
+            pthread_mutex_lock(&ex->pending_lock);
+            break;
+        }
+        pthread_mutex_lock(&ex->pending_lock);
+        if (frame != NULL || packet != NULL)
+            ex->emitted++;
+        ex->pending_next++;
+    }
+    pthread_mutex_unlock(&ex->pending_lock);
+    return ret;
+}
+
+/*
+ * Drops the frames of the current window that were not emitted, e.g. after a failed push.
+ */
+static void clear_pending(struct extractor *ex) {
+    for (unsigned int i = 0; i < ex->pending_count; i++) {
+        av_frame_free(&ex->pending[i].frame);
+        av_packet_free(&ex->pending[i].packet);
+    }
+    memset(ex->pending, 0, ex->pending_count * sizeof(struct pending));
+}
+
+static void free_pending(struct extractor *ex) {
+    if (ex->pending != NULL)
+        clear_pending(ex);
+    free(ex->pending);
+    ex->pending = NULL;
+    ex->pending_count = 0;
+}
+
+/*
+ * Splits the sorted plan into batches of neighbouring requests. A batch ends where the next request would
+ * be reached by seeking anyway, once it holds its share of the requests, so that workers rarely decode
+ * the same GOP twice.
+ */
+static void build_batches(struct extractor *ex) {
+    const struct plan *plan = &ex->plan;
+    unsigned int share = plan->count / (ex->options.jobs * 8) + 1;
+    unsigned int size = 0;
+
+    ex->batch_count = 0;
+    ex->batch_next = 0;
+    for (unsigned int i = 0; i < plan->count; i++, size++) {
+        const struct plan_entry *entry = &plan->entries[i];
+        if (i == 0 ||
+            (size >= share && !entry->sequential && source_should_seek(&ex->src, plan->entries[i - 1].ts, entry->ts)) ||
+            (size >= share * 4 && (!entry->sequential || ex->options.jobs > 1))) {
+            ex->batches[ex->batch_count++] = i;
+            size = 0;
+        }
+    }
+    ex->batches[ex->batch_count] = plan->count;
+}
+
+#define SELECT_NONE 0
+#define SELECT_CURRENT 1
+#define SELECT_PREVIOUS 2
+
+/*
+ * Tells which frame a request at ts settles on, given the timestamp of the last decoded frame and of the one
+ * before it (AV_NOPTS_VALUE if unknown), or SELECT_NONE if more frames are needed.
+ */
+static int select_frame(const struct extractor *ex, const struct source *from, int64_t ts, int64_t current,
+                        int64_t previous) {
+    if (ex->options.keyframes_only) {
+        if (current == source_keyframe_before(from, ts))
+            return SELECT_CURRENT;
+        if (current > ts)
+            return previous != AV_NOPTS_VALUE ? SELECT_PREVIOUS : SELECT_CURRENT;
+        return SELECT_NONE;
+    }
+    if (ex->tolerance > 0 && llabs(ts - current) <= ex->tolerance)
+        return SELECT_CURRENT;
+    if (previous != AV_NOPTS_VALUE && llabs(ts - current) >= llabs(ts - previous))
+        return SELECT_PREVIOUS;
+    return SELECT_NONE;
+}
+
+/*
+ * Serves a request from the frame cache by replaying the frame selection over a chain of cached frames that
+ * were decoded one right after the other. Returns 1 if resolved, 0 if the frame has to be decoded.
+ */
+static int resolve_cached(struct extractor *ex, const struct source *from, const struct plan_entry *entry,
+                          AVFrame *frame) {
+    int ret, selected;
+    int stream = from->video_stream_idx;
+    int64_t previous = AV_NOPTS_VALUE, current, next, found;
+
+    if (frame_cache_find(&ex->frame_cache, stream, entry->ts - ex->tolerance, &current, &next) < 0)
+        goto miss;
+    while ((selected = select_frame(ex, from, entry->ts, current, previous)) == SELECT_NONE) {
+        if (current >= entry->ts) {
+            /* any later frame is farther away, so decoding would settle on this one next */
+            selected = SELECT_CURRENT;
+            break;
+        }
+        previous = current;
+        current = next;
+        if (current == AV_NOPTS_VALUE ||
+            frame_cache_find(&ex->frame_cache, stream, current, &found, &next) < 0 || found != current)
+            goto miss;
+    }
+    if (frame_cache_get(&ex->frame_cache, stream, selected == SELECT_CURRENT ? current : previous, frame) < 0)
+        goto miss;
+    ret = resolve_request(ex, entry, frame, NULL, from);
+    av_frame_unref(frame);
+    return ret < 0 ? ret : 1;
+
+    miss:
+    frame_cache_miss(&ex->frame_cache);
+    return 0;
+}
+
+/*
+ * Prefetches the GOP of the request at cursor and those of the next PREFETCH_GOPS - 1 GOPs the batch needs,
+ * so that they are read in the background while the current one decodes.
+ */
+static void prefetch_ahead(struct extractor *ex, struct source *from, unsigned int cursor, unsigned int end) {
+    const struct plan_entry *entries = ex->plan.entries;
+    int64_t keyframe = source_keyframe_before(from, entries[cursor].ts - ex->tolerance);
+    unsigned int gops = 1;
+
+    if (from->input.pb == NULL || keyframe == AV_NOPTS_VALUE)
+        return;
+    source_prefetch(from, entries[cursor].ts - ex->tolerance);
+    for (unsigned int i = cursor + 1; i < end && gops < PREFETCH_GOPS; i++) {
+        int64_t next = source_keyframe_before(from, entries[i].ts - ex->tolerance);
+        if (next != keyframe) {
+            source_prefetch(from, entries[i].ts - ex->tolerance);
+            keyframe = next;
+            gops++;
+        }
+    }
+}
+
+/*
+ * Decodes the source forward over the sorted requests [begin, end), resolving every request
+ * to its nearest frame, or to the first one the keyframe or tolerance mode accepts.
+ * The worker keeps its last decoded frame between batches, so that a range that goes on in its next batch
+ * is decoded on without seeking, as long as that batch does not start before the last request it resolved.
+ */
+static int extract_batch(struct extractor *ex, struct worker *worker, unsigned int begin, unsigned int end) {
+    int ret = 0, selected;
+    unsigned int cursor = begin;
+    const struct plan_entry *entries = ex->plan.entries;
+    struct source *from = worker->src;
+    AVFrame *prev_frame = worker->prev_frame;
+    int64_t tolerance = ex->tolerance;
+    AVFrame *frame = av_frame_alloc();
+
+    if (!frame) {
+        fprintf(stderr, "Could not allocate frame\n");
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if (begin < end && worker->last_ts > entries[begin].ts)
+        av_frame_unref(prev_frame);
+
+    while (cursor < end && ex->stop == 0 && ex->error == 0) {
+        int64_t req_ts = entries[cursor].ts;
+        int64_t pos = prev_frame->format < 0 ? AV_NOPTS_VALUE : prev_frame->best_effort_timestamp;
+
+        if (pos != AV_NOPTS_VALUE && select_frame(ex, from, req_ts, pos, AV_NOPTS_VALUE) == SELECT_CURRENT) {
+            if ((ret = resolve_request(ex, &entries[cursor++], prev_frame, NULL, from)) != 0)
+                goto end;
+            continue;
+        }
+        if (ex->cache_frames && (ret = resolve_cached(ex, from, &entries[cursor], frame)) != 0) {
+            if (ret < 0)
+                goto end;
+            ret = 0;
+            cursor++;
+            continue;
+        }
+
+        if ((pos == AV_NOPTS_VALUE || !entries[cursor].sequential) &&
+            source_should_seek(from, pos, req_ts - tolerance)) {
+            source_seek(from, req_ts - tolerance);
+            prefetch_ahead(ex, from, cursor, end);
+            av_frame_unref(prev_frame);
+            pos = AV_NOPTS_VALUE;
+        }
+
+        source_set_target(from, req_ts - tolerance);
+        ret = source_decode_frame(from, frame);
+        if (ret == AVERROR_EOF) {
+            for (ret = 0; cursor < end && ret == 0; cursor++)
+                ret = resolve_request(ex, &entries[cursor], pos != AV_NOPTS_VALUE ? prev_frame : NULL, NULL, from);
+            break;
+        } else if (ret < 0) {
+            break;
+        }
+        if (ex->cache_frames) {
+            int64_t prev_pts = pos != AV_NOPTS_VALUE && source_decodes_all_after(from, pos) ? pos : AV_NOPTS_VALUE;
+            if ((ret = frame_cache_put(&ex->frame_cache, from->video_stream_idx, frame, prev_pts)) < 0)
+                goto end;
+        }
+
+        while (cursor < end && (selected = select_frame(ex, from, entries[cursor].ts, frame->best_effort_timestamp,
+                                                        pos)) != SELECT_NONE) {
+            if ((ret = resolve_request(ex, &entries[cursor++], selected == SELECT_CURRENT ? frame : prev_frame,
+                                       NULL, from)) != 0)
+                goto end;
+        }
+        av_frame_unref(prev_frame);
+        av_frame_move_ref(prev_frame, frame);
+    }
+
+    end:
+    if (cursor > begin)
+        worker->last_ts = entries[cursor - 1].ts;
+    av_frame_free(&frame);
+    return ret;
+}
+
+/*
+ * Same as extract_batch for intra-only sources in the output codec: the packets are selected by their
+ * timestamps and passed on as they are, without decoding.
+ */
+static int copy_batch(struct extractor *ex, struct source *from, unsigned int begin, unsigned int end) {
+    int ret = 0, selected;
+    unsigned int cursor = begin;
+    const struct plan_entry *entries = ex->plan.entries;
+    int64_t tolerance = ex->tolerance;
+    int64_t pos = AV_NOPTS_VALUE;
+    AVPacket *packet = av_packet_alloc();
+    AVPacket *prev_packet = av_packet_alloc();
+
+    if (!packet || !prev_packet) {
+        fprintf(stderr, "Could not allocate packet\n");
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    while (cursor < end && ex->stop == 0 && ex->error == 0) {
+        int64_t req_ts = entries[cursor].ts;
+
+        if (pos != AV_NOPTS_VALUE && select_frame(ex, from, req_ts, pos, AV_NOPTS_VALUE) == SELECT_CURRENT) {
+            if ((ret = resolve_request(ex, &entries[cursor++], NULL, prev_packet, from)) != 0)
+                goto end;
+            continue;
+        }
+
+        if ((pos == AV_NOPTS_VALUE || !entries[cursor].sequential) &&
+            source_should_seek(from, pos, req_ts - tolerance)) {
+            source_seek(from, req_ts - tolerance);
+            prefetch_ahead(ex, from, cursor, end);
+            av_packet_unref(prev_packet);
+            pos = AV_NOPTS_VALUE;
+        }
+
+        ret = source_read_packet(from, packet);
+        if (ret == AVERROR_EOF) {
+            for (ret = 0; cursor < end && ret == 0; cursor++)
+                ret = resolve_request(ex, &entries[cursor], NULL, pos != AV_NOPTS_VALUE ? prev_packet : NULL, from);
+            break;
+        } else if (ret < 0) {
+            fprintf(stderr, "Error while reading a packet: %s\n", av_err2str(ret));
+            break;
+        }
+
+        int64_t packet_ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+        while (cursor < end &&
+               (selected = select_frame(ex, from, entries[cursor].ts, packet_ts, pos)) != SELECT_NONE) {
+            if ((ret = resolve_request(ex, &entries[cursor++], NULL,
+                                       selected == SELECT_CURRENT ? packet : prev_packet, from)) != 0)
+                goto end;
+        }
+        av_packet_unref(prev_packet);
+        av_packet_move_ref(prev_packet, packet);
+        pos = packet_ts;
+    }
+
+    end:
+    av_packet_free(&packet);
+    av_packet_free(&prev_packet);
+    return ret;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *worker = arg;
+    struct extractor *ex = worker->ex;
+
+    if (worker->src == &worker->own_src && worker->src->fmt_ctx == NULL) {
+        if ((worker->ret = source_open(worker->src, ex->filename, ex->options.input_mode, ex->options.width,
+                                       ex->options.height, ex->options.huge_pages, ex->options.decoder_threads,
+                                       ex->options.decoder_thread_type)) == 0) {
+            worker->src->index = ex->src.index;
+            worker->src->stats.enabled = ex->stats.enabled;
+            source_set_skip_mode(worker->src, ex->options.skip_mode);
+            source_set_keyframes_only(worker->src, ex->options.keyframes_only);
+        }
+    }
+    if (worker->ret == 0 && worker->prev_frame == NULL && (worker->prev_frame = av_frame_alloc()) == NULL)
+        worker->ret = AVERROR(ENOMEM);
+    pthread_mutex_lock(&ex->pending_lock);
+    while (worker->ret == 0 && ex->stop == 0 && ex->error == 0) {
+        unsigned int batch;
+        if (ex->batch_next == ex->batch_count) {
+            if (ex->windows_done)
+                break;
+            pthread_cond_wait(&ex->pending_cond, &ex->pending_lock);
+            continue;
+        }
+        batch = ex->batch_next++;
+        ex->workers_busy++;
+        pthread_mutex_unlock(&ex->pending_lock);
+        if (ex->copy_packets)
+            worker->ret = copy_batch(ex, worker->src, ex->batches[batch], ex->batches[batch + 1]);
+        else
+            worker->ret = extract_batch(ex, worker, ex->batches[batch], ex->batches[batch + 1]);
+        pthread_mutex_lock(&ex->pending_lock);
+        ex->workers_busy--;
+        pthread_cond_broadcast(&ex->pending_cond);
+    }
+
+    if (worker->ret != 0)
+        ex->error = worker->ret;
+    ex->workers_running--;
+    pthread_cond_broadcast(&ex->pending_cond);
+    pthread_mutex_unlock(&ex->pending_lock);
+    return NULL;
+}
+
+static int start_stages(struct extractor *ex) {
+    int ret;
+    if (ex->copy_packets) {
+        if ((ret = open_copy(ex)) < 0)
+            return ret;
+        if (pthread_create(&ex->stages[ex->stage_count++], NULL, output_main, ex) != 0)
+            return AVERROR(EAGAIN);
+        return 0;
+    }
+    if ((ret = open_encoder(ex, "mjpeg")) < 0)
+        return ret;
+    ex->converting = convert_full_range(ex->src.codec_ctx->pix_fmt) != convert_full_range(ex->codec_ctx->pix_fmt) ||
+                     ex->src.codec_ctx->width != ex->codec_ctx->width ||
+                     ex->src.codec_ctx->height != ex->codec_ctx->height;
+    if (ex->converting)
+        convert_init(&ex->convert, ex->codec_ctx->width, ex->codec_ctx->height, ex->codec_ctx->pix_fmt, 0);
+    if (ex->options.lenscorrection)
+        lens_init(&ex->lens, ex->options.lenscorrection_k1, LENSCORRECTION_K2, 0);
+    ex->filtering = ex->converting || ex->options.lenscorrection;
+    if (ex->filtering && pthread_create(&ex->stages[ex->stage_count++], NULL, filter_main, ex) != 0)
+        return AVERROR(EAGAIN);
+    if (pthread_create(&ex->stages[ex->stage_count++], NULL, encode_main, ex) != 0)
+        return AVERROR(EAGAIN);
+    if (pthread_create(&ex->stages[ex->stage_count++], NULL, output_main, ex) != 0)
+        return AVERROR(EAGAIN);
+    return 0;
+}
+
+/*
+ * Sets up the queues and starts the output stages, which then live across all the extract calls.
+ */
+static int start_pipeline(struct extractor *ex) {
+    int ret;
+
+    for (unsigned int i = 0; i < ex->options.jobs; i++) {
+        ex->workers[i].ex = ex;
+        ex->workers[i].src = i == 0 ? &ex->src : &ex->workers[i].own_src;
+    }
+    if (queue_init(&ex->filter_queue, "filter", QUEUE_CAPACITY, free_frame_item) < 0 ||
+        queue_init(&ex->encode_queue, "encode", QUEUE_CAPACITY, free_frame_item) < 0 ||
+        queue_init(&ex->output_queue, "output", QUEUE_CAPACITY, free_packet_item) < 0) {
+        fprintf(stderr, "Could not allocate the extraction state\n");
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = start_stages(ex)) < 0) {
+        fprintf(stderr, "Could not start the output pipeline: %s\n", av_err2str(ret));
+        queue_abort(&ex->filter_queue);
+        queue_abort(&ex->encode_queue);
+        queue_abort(&ex->output_queue);
+    }
+    return ret;
+}
+
+/*
+ * Lets the output stages drain and stop, then releases the pipeline.
+ */
+static void finish_pipeline(struct extractor *ex) {
+    if (pipeline_input(ex)->items != NULL)
+        queue_close(pipeline_input(ex));
+    for (unsigned int i = 0; i < ex->stage_count; i++)
+        pthread_join(ex->stages[i], NULL);
+    if (ex->options.verbose && ex->stage_count > 0) {
+        if (ex->filtering)
+            queue_report(&ex->filter_queue);
+        queue_report(&ex->encode_queue);
+        queue_report(&ex->output_queue);
+        if (!ex->copy_packets)
+            fprintf(stderr, "Reused %lu encoded packets for repeated frames\n", (unsigned long) ex->reused);
+    }
+    ex->stage_count = 0;
+    free_filtered(ex);
+    queue_free(&ex->filter_queue);
+    queue_free(&ex->encode_queue);
+    queue_free(&ex->output_queue);
+}
+
+static int open_index(struct extractor *ex) {
+    int ret;
+    const char *index_filename = ex->options.index_filename;
+    if ((ret = index_load(&ex->index, index_filename, ex->filename, ex->src.stream)) == 0)
+        return 0;
+    if (ret != AVERROR(ENOENT))
+        fprintf(stderr, "Rebuilding stale or invalid index %s\n", index_filename);
+    if ((ret = index_build(&ex->index, ex->src.fmt_ctx, ex->src.video_stream_idx)) < 0) {
+        fprintf(stderr, "Could not build the index: %s\n", av_err2str(ret));
+        return ret;
+    }
+    if ((ret = index_save(&ex->index, index_filename, ex->filename, ex->src.stream)) < 0)
+        fprintf(stderr, "Could not save the index %s: %s\n", index_filename, av_err2str(ret));
+    return 0;
+}
+
+/*
+ * Opens the source and starts the output stages. The packets of all the following extract calls go to
+ * options->packet_cb. The filename must stay valid until the extractor is closed.
+ */
+int extractor_open(struct extractor **extractor, const char *filename, const struct extractor_options *options) {
+    int ret;
+    struct extractor *ex;
+
+    *extractor = NULL;
+    if (options->jobs < 1 || options->packet_cb == NULL)
+        return AVERROR(EINVAL);
+    if ((ex = calloc(1, sizeof(struct extractor))) == NULL)
+        return AVERROR(ENOMEM);
+    if ((ex->workers = calloc(options->jobs, sizeof(struct worker))) == NULL) {
+        free(ex);
+        return AVERROR(ENOMEM);
+    }
+    ex->options = *options;
+    ex->filename = filename;
+    if (ex->options.decoder_threads == 0 && ex->options.jobs > 1)
+        ex->options.decoder_threads = (unsigned int) FFMAX(1, (av_cpu_count() + ex->options.jobs - 1) /
+                                                              ex->options.jobs);
+    source_init(&ex->src);
+    index_init(&ex->index);
+    plan_init(&ex->plan);
+    for (unsigned int i = 0; i < ex->options.jobs; i++)
+        source_init(&ex->workers[i].own_src);
+    stats_init(&ex->stats, ex->options.stats != NULL);
+    pthread_mutex_init(&ex->pending_lock, NULL);
+    pthread_mutex_init(&ex->reuse_lock, NULL);
+    pthread_cond_init(&ex->pending_cond, NULL);
+
+    if ((ret = source_open(&ex->src, filename, ex->options.input_mode, ex->options.width, ex->options.height,
+                           ex->options.huge_pages, ex->options.decoder_threads,
+                           ex->options.decoder_thread_type)) < 0)
+        goto fail;
+
+    source_set_skip_mode(&ex->src, ex->options.skip_mode);
+    source_set_keyframes_only(&ex->src, ex->options.keyframes_only);
+    ex->src.stats.enabled = ex->stats.enabled;
+    ex->tolerance = av_rescale_q(ex->options.tolerance_ms * 1000, AV_TIME_BASE_Q, ex->src.stream->time_base);
+    ex->copy_packets = !ex->options.lenscorrection && ex->options.width == 0 && ex->options.height == 0 &&
+                       source_can_copy(&ex->src, AV_CODEC_ID_MJPEG);
+    if (ex->copy_packets && ex->options.verbose)
+        fprintf(stderr, "Copying the intra-only input packets without re-encoding\n");
+    if (ex->src.codec_ctx->lowres > 0 && ex->options.verbose)
+        fprintf(stderr, "Decoding at 1/%d of the source resolution\n", 1 << ex->src.codec_ctx->lowres);
+
+    if (ex->options.index_filename != NULL) {
+        if ((ret = open_index(ex)) < 0)
+            goto fail;
+        ex->src.index = &ex->index;
+    }
+    ex->cache_frames = ex->options.frame_cache_size > 0 && !ex->copy_packets && !ex->options.keyframes_only;
+    if (ex->cache_frames)
+        frame_cache_init(&ex->frame_cache, ex->options.frame_cache_size);
+    if ((ret = start_pipeline(ex)) < 0)
+        goto fail;
+    *extractor = ex;
+    return 0;
+
+    fail:
+    extractor_close(&ex);
+    return ret;
+}
+
+const AVCodecParameters *extractor_codecpar(const struct extractor *extractor) {
+    return extractor->codecpar;
+}
+
+/*
+ * The nominal frame rate of the source, {0, 1} if unknown.
+ */
+AVRational extractor_frame_rate(const struct extractor *extractor) {
+    AVRational frame_rate = extractor->src.stream->avg_frame_rate;
+    if (frame_rate.num <= 0 || frame_rate.den <= 0)
+        frame_rate = extractor->src.stream->r_frame_rate;
+    return frame_rate.num > 0 && frame_rate.den > 0 ? frame_rate : (AVRational) {0, 1};
+}
+
+/*
+ * Extracts the frames at the given times, in microseconds. The requests are resolved in timestamp order
+ * by up to `jobs` workers, each with its own demuxer and decoder, while the calling thread feeds the frames
+ * in the original order to the filter, encoder and output stages. Returns once every frame is queued.
+ */
+int extractor_extract(struct extractor *ex, const int64_t *times, unsigned int count) {
+    return extractor_extract_sequential(ex, times, NULL, count);
+}
+
+/*
+ * Plans the next window of requests and hands its batches to the workers once none of them is still busy
+ * with the previous window, whose frames have all been emitted by then.
+ */
+static int plan_window(struct extractor *ex, const int64_t *times, const uint8_t *sequential, unsigned int count) {
+    int ret = 0;
+
+    pthread_mutex_lock(&ex->pending_lock);
+    while (ex->workers_busy > 0)
+        pthread_cond_wait(&ex->pending_cond, &ex->pending_lock);
+    clear_pending(ex);
+    plan_clear(&ex->plan);
+    for (unsigned int i = 0; i < count; i++) {
+        if (plan_add(&ex->plan, (int64_t) (times[i] / (av_q2d(ex->src.stream->time_base) * 1e+6)),
+                     sequential != NULL && sequential[i]) < 0) {
+            fprintf(stderr, "Could not allocate the extraction plan\n");
+            ex->pending_count = ex->batch_count = ex->batch_next = 0;
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+    }
+    plan_sort(&ex->plan);
+    ex->pending_count = count;
+    ex->pending_next = 0;
+    build_batches(ex);
+    pthread_cond_broadcast(&ex->pending_cond);
+
+    end:
+    pthread_mutex_unlock(&ex->pending_lock);
+    return ret;
+}
+
+/*
+ * Same as extractor_extract, where sequential, if not NULL, marks the times that follow the previous one
+ * of their range. The source is decoded forward from one such time to the next, without seeking in between.
+ * The times are sorted REORDER_WINDOW per worker at a time, in their original order, so that at most that many
+ * decoded frames wait for the ones before them however the times are ordered. Workers that run out of batches
+ * wait for the next window rather than running ahead of the emitter.
+ */
+int extractor_extract_sequential(struct extractor *ex, const int64_t *times, const uint8_t *sequential,
+                                 unsigned int count) {
+    int ret = 0;
+    unsigned int started = 0, jobs = ex->options.jobs, window = REORDER_WINDOW * jobs;
+
+    if (ex->error != 0)
+        return ex->error;
+    ex->pending = calloc(window, sizeof(struct pending));
+    ex->batches = malloc((window + 1) * sizeof(unsigned int));
+    if (ex->pending == NULL || ex->batches == NULL) {
+        fprintf(stderr, "Could not allocate the extraction state\n");
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    ex->pending_count = ex->pending_next = 0;
+    ex->batch_count = ex->batch_next = 0;
+    ex->windows_done = 0;
+
+    ex->workers_running = jobs;
+    for (; started < jobs; started++) {
+        struct worker *worker = &ex->workers[started];
+        worker->ret = 0;
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            fprintf(stderr, "Could not start a worker thread\n");
+            pthread_mutex_lock(&ex->pending_lock);
+            ex->workers_running -= jobs - started;
+            pthread_mutex_unlock(&ex->pending_lock);
+            break;
+        }
+    }
+
+    for (unsigned int begin = 0; begin < count && started > 0 && ret == 0 && ex->stop == 0 && ex->error == 0;
+         begin += window) {
+        if ((ret = plan_window(ex, times + begin, sequential != NULL ? sequential + begin : NULL,
+                               FFMIN(window, count - begin))) == 0)
+            ret = emit_pending(ex);
+    }
+
+    pthread_mutex_lock(&ex->pending_lock);
+    ex->windows_done = 1;
+    pthread_cond_broadcast(&ex->pending_cond);
+    pthread_mutex_unlock(&ex->pending_lock);
+    for (unsigned int i = 0; i < started; i++)
+        pthread_join(ex->workers[i].thread, NULL);
+    if (ret == 0 && ex->error != 0)
+        ret = ex->error;
+    if (ret == 0 && started == 0)
+        ret = AVERROR(EAGAIN);
+
+    end:
+    free(ex->batches);
+    ex->batches = NULL;
+    free_pending(ex);
+    return ret;
+}
+
+/*
+ * Waits until every frame queued by the previous extract calls has been passed to the packet callback.
+ * MJPEG encodes every frame into exactly one packet, so the queued frames and the packets can be counted alike.
+ */
+int extractor_flush(struct extractor *ex) {
+    int ret;
+    pthread_mutex_lock(&ex->pending_lock);
+    while (ex->delivered < ex->emitted && ex->error == 0)
+        pthread_cond_wait(&ex->pending_cond, &ex->pending_lock);
+    ret = ex->error;
+    pthread_mutex_unlock(&ex->pending_lock);
+    return ret;
+}
+
+/*
+ * Redirects the packets to another callback. Only valid while no frames are in flight, e.g. after a flush.
+ */
+void extractor_set_output(struct extractor *ex, extractor_packet_cb packet_cb, void *opaque) {
+    ex->options.packet_cb = packet_cb;
+    ex->options.opaque = opaque;
+}
+
+/*
+ * Makes the workers give up at the next frame. Only sets a flag, so it may be called from a signal handler.
+ */
+void extractor_stop(struct extractor *extractor) {
+    extractor->stop = 1;
+}
+
+/*
+ * Compares what the demuxers read from the input with the video packets they returned, over all the workers.
+ */
+static void report_input(struct extractor *ex) {
+    uint64_t bytes_read = 0, bytes_demuxed = 0, bytes_prefetched = 0, seeks = 0;
+    for (unsigned int i = 0; i < ex->options.jobs; i++) {
+        struct source *src = i == 0 ? &ex->src : &ex->workers[i].own_src;
+        if (src->fmt_ctx == NULL)
+            continue;
+        if (src->fmt_ctx->pb != NULL) {
+            bytes_read += (uint64_t) src->fmt_ctx->pb->bytes_read;
+            seeks += (uint64_t) src->fmt_ctx->pb->seek_count;
+        }
+        bytes_demuxed += src->stats.bytes_demuxed;
+        bytes_prefetched += src->input.bytes_prefetched;
+        input_report(&src->input);
+    }
+    fprintf(stderr, "Input: %.1f MiB read in %lu seeks for %.1f MiB of video packets, %.1f MiB prefetched\n",
+            bytes_read / 1048576.0, (unsigned long) seeks, bytes_demuxed / 1048576.0, bytes_prefetched / 1048576.0);
+}
+
+/*
+ * Adds the stage timers and counters of the output stages and of every source to the caller's stats.
+ */
+static void collect_stats(struct extractor *ex) {
+    struct stats *total = ex->options.stats;
+    ex->stats.frames_emitted = ex->emitted;
+    ex->stats.frames_reused = ex->reused;
+    stats_add(total, &ex->stats);
+    for (unsigned int i = 0; i < ex->options.jobs; i++) {
+        struct source *src = i == 0 ? &ex->src : &ex->workers[i].own_src;
+        if (src->fmt_ctx == NULL)
+            continue;
+        if (src->fmt_ctx->pb != NULL)
+            src->stats.bytes_read = (uint64_t) src->fmt_ctx->pb->bytes_read;
+        stats_add(total, &src->stats);
+    }
+}
+
+/*
+ * Waits for the queued frames to reach the packet callback and frees the extractor.
+ * Returns the first error of the output stages, if any.
+ */
+int extractor_close(struct extractor **extractor) {
+    int ret;
+    struct extractor *ex = *extractor;
+
+    if (ex == NULL)
+        return 0;
+    *extractor = NULL;
+    finish_pipeline(ex);
+    ret = ex->error;
+    if (ex->options.verbose)
+        report_input(ex);
+    if (ex->options.stats != NULL)
+        collect_stats(ex);
+    for (unsigned int i = 1; i < ex->options.jobs; i++)
+        source_close(&ex->workers[i].own_src);
+    for (unsigned int i = 0; i < ex->options.jobs; i++)
+        av_frame_free(&ex->workers[i].prev_frame);
+    if (ex->cache_frames) {
+        frame_cache_report(&ex->frame_cache);
+        frame_cache_free(&ex->frame_cache);
+    }
+    for (unsigned int i = 0; i < REUSE_CAPACITY; i++)
+        av_packet_free(&ex->reuse_packets[i]);
+    lens_uninit(&ex->lens);
+    convert_uninit(&ex->convert);
+    if (ex->options.encoders != NULL && ret == 0)
+        encoder_pool_give(ex->options.encoders, &ex->codec_ctx, ex->options.encoder_threads);
+    avcodec_free_context(&ex->codec_ctx);
+    avcodec_parameters_free(&ex->codecpar);
+    source_close(&ex->src);
+    plan_free(&ex->plan);
+    index_free(&ex->index);
+    pthread_mutex_destroy(&ex->pending_lock);
+    pthread_mutex_destroy(&ex->reuse_lock);
+    pthread_cond_destroy(&ex->pending_cond);
+    free(ex->workers);
+    free(ex);
+    return ret;
+}
@@ -0,0 +1,56 @@
+#ifndef FRAME_EXTRACTOR_EXTRACTOR_H
+#define FRAME_EXTRACTOR_EXTRACTOR_H
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+#include "encoder_pool.h"
+#include "input.h"
+#include "stats.h"
+
+/*
+ * Receives the extracted frames as JPEG packets, in request order, on the output thread of the extractor.
+ * packet->pts is the timestamp of the source frame in microseconds. The packet stays owned by the extractor,
+ * but its data can be taken with av_packet_move_ref. Requests that land on the same source frame share
+ * the data, which must not be modified. A negative return value stops the extraction.
+ */
+typedef int (*extractor_packet_cb)(void *opaque, AVPacket *packet);
+
+struct extractor_options {
+    unsigned int quality;
+    unsigned int jobs;
+    unsigned int decoder_threads;
+    unsigned int encoder_threads;
+    int decoder_thread_type;
+    int skip_mode;
+    int keyframes_only;
+    unsigned long tolerance_ms;
+    int width;
+    int height;
+    int lenscorrection;
+    double lenscorrection_k1;
+    const char *index_filename;
+    size_t frame_cache_size;
+    int huge_pages;
+    enum input_mode input_mode;
+    int verbose;
+    struct stats *stats;
+    struct encoder_pool *encoders;
+    extractor_packet_cb packet_cb;
+    void *opaque;
+};
+
+struct extractor;
+
+void extractor_default_options(struct extractor_options *options);
+int extractor_open(struct extractor **extractor, const char *filename, const struct extractor_options *options);
+const AVCodecParameters *extractor_codecpar(const struct extractor *extractor);
+AVRational extractor_frame_rate(const struct extractor *extractor);
+int extractor_extract(struct extractor *extractor, const int64_t *times, unsigned int count);
+int extractor_extract_sequential(struct extractor *extractor, const int64_t *times, const uint8_t *sequential,
+                                 unsigned int count);
+int extractor_flush(struct extractor *extractor);
+void extractor_set_output(struct extractor *extractor, extractor_packet_cb packet_cb, void *opaque);
+void extractor_stop(struct extractor *extractor);
+int extractor_close(struct extractor **extractor);
+
+#endif //FRAME_EXTRACTOR_EXTRACTOR_H
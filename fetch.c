@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavformat/avio.h>
+#include <libavutil/common.h>
+#include <libavutil/dict.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include "fetch.h"
+
+#define FETCH_BLOCK_SIZE (1 << 20)
+#define RANGE_BLOCKS_MAX 16
+#define DEMAND_BLOCKS 2
+
+#define BLOCK_EMPTY 0
+#define BLOCK_FETCHING 1
+#define BLOCK_READY 2
+#define BLOCK_FAILED 3
+
+static struct fetch_block *find_block(struct fetcher *fetcher, int64_t index) {
+    for (unsigned int i = 0; i < fetcher->block_count; i++) {
+        if (fetcher->blocks[i].state != BLOCK_EMPTY && fetcher->blocks[i].index == index)
+            return &fetcher->blocks[i];
+    }
+    return NULL;
+}
+
+/*
+ * Takes over the least recently used block that is not being fetched, or returns NULL if all of them are.
+ */
+static struct fetch_block *reserve_block(struct fetcher *fetcher, int64_t index) {
+    struct fetch_block *victim = NULL;
+    for (unsigned int i = 0; i < fetcher->block_count; i++) {
+        struct fetch_block *block = &fetcher->blocks[i];
+        if (block->state != BLOCK_FETCHING && (victim == NULL || block->used < victim->used))
+            victim = block;
+    }
+    if (victim == NULL)
+        return NULL;
+    victim->index = index;
+    victim->state = BLOCK_FETCHING;
+    victim->error = 0;
+    victim->size = 0;
+    return victim;
+}
+
+/*
+ * Queues a range request, appending it to the last queued one if they are adjacent. Demand reads go first.
+ * Every queued range holds at least one block being fetched, so the queue never holds more than block_count.
+ */
+static void push_range(struct fetcher *fetcher, int64_t first, unsigned int count, int urgent) {
+    unsigned int capacity = fetcher->block_count;
+    if (!urgent && fetcher->range_count > 0) {
+        struct fetch_range *last = &fetcher->ranges[(fetcher->range_head + fetcher->range_count - 1) % capacity];
+        if (last->first + last->count == first && last->count + count <= RANGE_BLOCKS_MAX) {
+            last->count += count;
+            return;
+        }
+    }
+    if (urgent) {
+        fetcher->range_head = (fetcher->range_head + capacity - 1) % capacity;
+        fetcher->ranges[fetcher->range_head] = (struct fetch_range) {first, count};
+    } else {
+        fetcher->ranges[(fetcher->range_head + fetcher->range_count) % capacity] = (struct fetch_range) {first, count};
+    }
+    fetcher->range_count++;
+    pthread_cond_signal(&fetcher->pending);
+}
+
+/*
+ * Queues the missing blocks of [first, last] as runs of adjacent blocks, one range request per run.
+ * Called with the lock held.
+ */
+static void queue_blocks(struct fetcher *fetcher, int64_t first, int64_t last, int urgent) {
+    int64_t run = 0;
+    unsigned int run_count = 0;
+
+    last = FFMIN(last, (fetcher->size - 1) / FETCH_BLOCK_SIZE);
+    for (int64_t index = first; index <= last; index++) {
+        int present = find_block(fetcher, index) != NULL;
+        if (run_count > 0 && (present || run_count == RANGE_BLOCKS_MAX)) {
+            push_range(fetcher, run, run_count, urgent);
+            run_count = 0;
+        }
+        if (present)
+            continue;
+        if (reserve_block(fetcher, index) == NULL)
+            break;
+        if (run_count++ == 0)
+            run = index;
+    }
+    if (run_count > 0)
+        push_range(fetcher, run, run_count, urgent);
+}
+
+static int interrupted(void *opaque) {
+    struct fetcher *fetcher = opaque;
+    return fetcher->closing;
+}
+
+static int open_range(struct fetcher *fetcher, AVIOContext **pb, int64_t begin, int64_t end) {
+    int ret;
+    AVDictionary *opts = NULL;
+    AVIOInterruptCB int_cb = {interrupted, fetcher};
+
+    av_dict_set_int(&opts, "offset", begin, 0);
+    av_dict_set_int(&opts, "end_offset", end, 0);
+    ret = avio_open2(pb, fetcher->url, AVIO_FLAG_READ, &int_cb, &opts);
+    av_dict_free(&opts);
+    return ret;
+}
+
+/*
+ * Fetches the blocks of a range with a single request, handing every block over as soon as it is complete.
+ */
+static void fetch_range(struct fetcher *fetcher, const struct fetch_range *range) {
+    int ret;
+    AVIOContext *pb = NULL;
+    int64_t begin = range->first * FETCH_BLOCK_SIZE;
+    int64_t end = FFMIN(fetcher->size, (range->first + range->count) * FETCH_BLOCK_SIZE);
+
+    ret = open_range(fetcher, &pb, begin, end);
+    for (unsigned int i = 0; i < range->count; i++) {
+        struct fetch_block *block;
+        size_t size = 0;
+
+        pthread_mutex_lock(&fetcher->lock);
+        block = find_block(fetcher, range->first + i);
+        pthread_mutex_unlock(&fetcher->lock);
+        while (ret >= 0 && size < FETCH_BLOCK_SIZE) {
+            int n = avio_read(pb, block->data + size, (int) (FETCH_BLOCK_SIZE - size));
+            if (n == AVERROR_EOF)
+                break;
+            if (n < 0)
+                ret = n;
+            else
+                size += (size_t) n;
+        }
+
+        pthread_mutex_lock(&fetcher->lock);
+        block->size = size;
+        block->state = ret < 0 ? BLOCK_FAILED : BLOCK_READY;
+        block->error = ret;
+        block->used = ++fetcher->clock;
+        fetcher->bytes_fetched += size;
+        pthread_cond_broadcast(&fetcher->fetched);
+        pthread_mutex_unlock(&fetcher->lock);
+    }
+    if (ret < 0 && !fetcher->closing)
+        fprintf(stderr, "Could not fetch bytes %ld-%ld of %s: %s\n", (long) begin, (long) end - 1, fetcher->url,
+                av_err2str(ret));
+    avio_closep(&pb);
+}
+
+static void *fetch_main(void *arg) {
+    struct fetcher *fetcher = arg;
+
+    pthread_mutex_lock(&fetcher->lock);
+    for (;;) {
+        while (fetcher->range_count == 0 && !fetcher->closing)
+            pthread_cond_wait(&fetcher->pending, &fetcher->lock);
+        if (fetcher->closing)
+            break;
+        struct fetch_range range = fetcher->ranges[fetcher->range_head];
+        fetcher->range_head = (fetcher->range_head + 1) % fetcher->block_count;
+        fetcher->range_count--;
+        fetcher->requests++;
+        pthread_mutex_unlock(&fetcher->lock);
+        fetch_range(fetcher, &range);
+        pthread_mutex_lock(&fetcher->lock);
+    }
+    pthread_mutex_unlock(&fetcher->lock);
+    return NULL;
+}
+
+/*
+ * Sizes the remote file with a one-byte range request and starts thread_count connections.
+ * Keeps block_count blocks of FETCH_BLOCK_SIZE bytes.
+ */
+int fetcher_open(struct fetcher *fetcher, const char *url, unsigned int block_count, unsigned int thread_count) {
+    int ret;
+    AVIOContext *pb = NULL;
+
+    memset(fetcher, 0, sizeof(*fetcher));
+    pthread_mutex_init(&fetcher->lock, NULL);
+    pthread_cond_init(&fetcher->pending, NULL);
+    pthread_cond_init(&fetcher->fetched, NULL);
+    fetcher->block_count = block_count;
+    if ((fetcher->url = av_strdup(url)) == NULL ||
+        (fetcher->blocks = calloc(block_count, sizeof(struct fetch_block))) == NULL ||
+        (fetcher->ranges = calloc(block_count, sizeof(struct fetch_range))) == NULL ||
+        (fetcher->threads = calloc(thread_count, sizeof(pthread_t))) == NULL) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (unsigned int i = 0; i < block_count; i++) {
+        if ((fetcher->blocks[i].data = malloc(FETCH_BLOCK_SIZE)) == NULL) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+    }
+
+    if ((ret = open_range(fetcher, &pb, 0, 1)) < 0)
+        goto fail;
+    fetcher->size = avio_size(pb);
+    avio_closep(&pb);
+    if (fetcher->size <= 0) {
+        fprintf(stderr, "The server does not tell the size of %s\n", url);
+        ret = AVERROR(ENOSYS);
+        goto fail;
+    }
+
+    for (; fetcher->thread_count < thread_count; fetcher->thread_count++) {
+        if (pthread_create(&fetcher->threads[fetcher->thread_count], NULL, fetch_main, fetcher) != 0) {
+            ret = AVERROR(EAGAIN);
+            goto fail;
+        }
+    }
+    return 0;
+
+    fail:
+    fetcher_close(fetcher);
+    return ret;
+}
+
+int64_t fetcher_size(const struct fetcher *fetcher) {
+    return fetcher->size;
+}
+
+/*
+ * Copies up to size bytes at pos out of the cache, fetching the block and the next one first if missing.
+ */
+int fetcher_read(struct fetcher *fetcher, int64_t pos, unsigned char *buf, int size) {
+    int ret, waited = 0, retried = 0;
+    int64_t index = pos / FETCH_BLOCK_SIZE;
+    size_t offset = (size_t) (pos % FETCH_BLOCK_SIZE);
+    struct fetch_block *block;
+
+    if (pos >= fetcher->size)
+        return AVERROR_EOF;
+    pthread_mutex_lock(&fetcher->lock);
+    fetcher->reads++;
+    for (;;) {
+        while ((block = find_block(fetcher, index)) == NULL || block->state == BLOCK_FETCHING) {
+            if (block == NULL)
+                queue_blocks(fetcher, index, index + DEMAND_BLOCKS - 1, 1);
+            waited = 1;
+            pthread_cond_wait(&fetcher->fetched, &fetcher->lock);
+        }
+        if (block->state != BLOCK_FAILED || retried)
+            break;
+        /* a failed prefetch is retried once on demand */
+        block->state = BLOCK_EMPTY;
+        retried = 1;
+    }
+    if (waited)
+        fetcher->waits++;
+    if (block->state == BLOCK_FAILED) {
+        ret = block->error;
+        block->state = BLOCK_EMPTY;
+    } else if (offset >= block->size) {
+        ret = AVERROR_EOF;
+    } else {
+        ret = (int) FFMIN((size_t) size, block->size - offset);
+        memcpy(buf, block->data + offset, (size_t) ret);
+        block->used = ++fetcher->clock;
+    }
+    pthread_mutex_unlock(&fetcher->lock);
+    return ret;
+}
+
+/*
+ * Queues the blocks of [begin, end) that are not cached yet. At most half of the cache is taken at a time,
+ * so that a large prefetch does not evict what is being read.
+ */
+void fetcher_prefetch(struct fetcher *fetcher, int64_t begin, int64_t end) {
+    int64_t first = begin / FETCH_BLOCK_SIZE;
+    if (begin < 0 || begin >= fetcher->size || end <= begin)
+        return;
+    pthread_mutex_lock(&fetcher->lock);
+    queue_blocks(fetcher, first, FFMIN((end - 1) / FETCH_BLOCK_SIZE, first + fetcher->block_count / 2 - 1), 0);
+    pthread_mutex_unlock(&fetcher->lock);
+}
+
+void fetcher_report(struct fetcher *fetcher) {
+    pthread_mutex_lock(&fetcher->lock);
+    fprintf(stderr, "HTTP: %lu range requests, %.1f MiB fetched, %lu of %lu reads waited for the network\n",
+            (unsigned long) fetcher->requests, fetcher->bytes_fetched / 1048576.0, (unsigned long) fetcher->waits,
+            (unsigned long) fetcher->reads);
+    pthread_mutex_unlock(&fetcher->lock);
+}
+
+void fetcher_close(struct fetcher *fetcher) {
+    pthread_mutex_lock(&fetcher->lock);
+    fetcher->closing = 1;
+    pthread_cond_broadcast(&fetcher->pending);
+    pthread_mutex_unlock(&fetcher->lock);
+    for (unsigned int i = 0; i < fetcher->thread_count; i++)
+        pthread_join(fetcher->threads[i], NULL);
+    if (fetcher->blocks != NULL) {
+        for (unsigned int i = 0; i < fetcher->block_count; i++)
+            free(fetcher->blocks[i].data);
+    }
+    free(fetcher->blocks);
+    free(fetcher->ranges);
+    free(fetcher->threads);
+    av_freep(&fetcher->url);
+    pthread_mutex_destroy(&fetcher->lock);
+    pthread_cond_destroy(&fetcher->pending);
+    pthread_cond_destroy(&fetcher->fetched);
+    memset(fetcher, 0, sizeof(*fetcher));
+}
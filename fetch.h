@@ -0,0 +1,55 @@
+#ifndef FRAME_EXTRACTOR_FETCH_H
+#define FRAME_EXTRACTOR_FETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+struct fetch_block {
+    int64_t index;
+    int state;
+    int error;
+    uint64_t used;
+    unsigned char *data;
+    size_t size;
+};
+
+struct fetch_range {
+    int64_t first;
+    unsigned int count;
+};
+
+/*
+ * A remote source read in fixed-size blocks through HTTP range requests. Runs of missing blocks are fetched
+ * as one request by a few background connections, and the fetched blocks are kept in a small LRU cache,
+ * so that the byte ranges of the upcoming GOPs can be requested well before the demuxer gets there.
+ */
+struct fetcher {
+    char *url;
+    int64_t size;
+    struct fetch_block *blocks;
+    unsigned int block_count;
+    struct fetch_range *ranges;
+    unsigned int range_head;
+    unsigned int range_count;
+    pthread_t *threads;
+    unsigned int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t pending;
+    pthread_cond_t fetched;
+    volatile int closing;
+    uint64_t clock;
+    uint64_t requests;
+    uint64_t bytes_fetched;
+    uint64_t reads;
+    uint64_t waits;
+};
+
+int fetcher_open(struct fetcher *fetcher, const char *url, unsigned int block_count, unsigned int thread_count);
+int64_t fetcher_size(const struct fetcher *fetcher);
+int fetcher_read(struct fetcher *fetcher, int64_t pos, unsigned char *buf, int size);
+void fetcher_prefetch(struct fetcher *fetcher, int64_t begin, int64_t end);
+void fetcher_report(struct fetcher *fetcher);
+void fetcher_close(struct fetcher *fetcher);
+
+#endif //FRAME_EXTRACTOR_FETCH_H
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/tree.h>
+#include "frame_cache.h"
+
+static int compare_entries(const void *key, const void *b) {
+    const struct frame_cache_entry *entry_a = key;
+    const struct frame_cache_entry *entry_b = b;
+    if (entry_a->stream != entry_b->stream)
+        return entry_a->stream < entry_b->stream ? -1 : 1;
+    if (entry_a->pts != entry_b->pts)
+        return entry_a->pts < entry_b->pts ? -1 : 1;
+    return 0;
+}
+
+static size_t frame_size(const AVFrame *frame) {
+    size_t size = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i] != NULL; i++)
+        size += (size_t) frame->buf[i]->size;
+    return size;
+}
+
+static void unlink_entry(struct frame_cache *cache, struct frame_cache_entry *entry) {
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void push_entry(struct frame_cache *cache, struct frame_cache_entry *entry) {
+    entry->next = cache->head;
+    entry->prev = NULL;
+    if (cache->head != NULL)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+    cache->head = entry;
+}
+
+static void remove_entry(struct frame_cache *cache, struct frame_cache_entry *entry) {
+    struct AVTreeNode *node = NULL;
+    av_tree_insert(&cache->root, entry, compare_entries, &node);
+    av_free(node);
+    unlink_entry(cache, entry);
+    cache->size -= entry->size;
+    av_frame_free(&entry->frame);
+    av_free(entry);
+}
+
+static struct frame_cache_entry *lookup(struct frame_cache *cache, int stream, int64_t pts, void *next[2]) {
+    struct frame_cache_entry key = {.stream = stream, .pts = pts};
+    return av_tree_find(cache->root, &key, compare_entries, next);
+}
+
+void frame_cache_init(struct frame_cache *cache, size_t budget) {
+    cache->budget = budget;
+    cache->size = 0;
+    cache->root = NULL;
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+/*
+ * Adds a reference to a decoded frame. prev_pts is the frame decoded right before it with nothing skipped
+ * in between, or AV_NOPTS_VALUE after a seek.
+ */
+int frame_cache_put(struct frame_cache *cache, int stream, const AVFrame *frame, int64_t prev_pts) {
+    int64_t pts = frame->best_effort_timestamp;
+    size_t size = frame_size(frame);
+    struct frame_cache_entry *entry, *prev;
+    struct AVTreeNode *node;
+
+    if (pts == AV_NOPTS_VALUE || size > cache->budget)
+        return 0;
+    pthread_mutex_lock(&cache->lock);
+    if (prev_pts != AV_NOPTS_VALUE && prev_pts < pts && (prev = lookup(cache, stream, prev_pts, NULL)) != NULL)
+        prev->next_pts = pts;
+    if ((entry = lookup(cache, stream, pts, NULL)) != NULL) {
+        unlink_entry(cache, entry);
+        push_entry(cache, entry);
+        pthread_mutex_unlock(&cache->lock);
+        return 0;
+    }
+
+    entry = av_mallocz(sizeof(struct frame_cache_entry));
+    node = av_tree_node_alloc();
+    if (entry == NULL || node == NULL || (entry->frame = av_frame_clone(frame)) == NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        av_free(entry);
+        av_free(node);
+        return AVERROR(ENOMEM);
+    }
+    entry->stream = stream;
+    entry->pts = pts;
+    entry->next_pts = AV_NOPTS_VALUE;
+    entry->size = size;
+    av_tree_insert(&cache->root, entry, compare_entries, &node);
+    av_free(node);
+    push_entry(cache, entry);
+    cache->size += size;
+    while (cache->size > cache->budget && cache->tail != entry) {
+        remove_entry(cache, cache->tail);
+        cache->evictions++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+/*
+ * Finds the cached frame at or right before ts and the pts of the frame that follows it in decoding order,
+ * AV_NOPTS_VALUE if unknown. Returns AVERROR(ENOENT) if there is none.
+ */
+int frame_cache_find(struct frame_cache *cache, int stream, int64_t ts, int64_t *pts, int64_t *next_pts) {
+    void *next[2] = {NULL, NULL};
+    struct frame_cache_entry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+    if ((entry = lookup(cache, stream, ts, next)) == NULL)
+        entry = next[0];
+    if (entry == NULL || entry->stream != stream) {
+        pthread_mutex_unlock(&cache->lock);
+        return AVERROR(ENOENT);
+    }
+    *pts = entry->pts;
+    *next_pts = entry->next_pts;
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+/*
+ * References the cached frame at pts into frame and counts a hit.
+ */
+int frame_cache_get(struct frame_cache *cache, int stream, int64_t pts, AVFrame *frame) {
+    int ret;
+    struct frame_cache_entry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+    if ((entry = lookup(cache, stream, pts, NULL)) == NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        return AVERROR(ENOENT);
+    }
+    if ((ret = av_frame_ref(frame, entry->frame)) == 0) {
+        unlink_entry(cache, entry);
+        push_entry(cache, entry);
+        cache->hits++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return ret;
+}
+
+void frame_cache_miss(struct frame_cache *cache) {
+    pthread_mutex_lock(&cache->lock);
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void frame_cache_report(struct frame_cache *cache) {
+    pthread_mutex_lock(&cache->lock);
+    fprintf(stderr, "Frame cache: %lu hits, %lu misses, %lu evictions, %.1f of %.1f MiB in use\n",
+            (unsigned long) cache->hits, (unsigned long) cache->misses, (unsigned long) cache->evictions,
+            cache->size / 1048576.0, cache->budget / 1048576.0);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void frame_cache_free(struct frame_cache *cache) {
+    while (cache->tail != NULL)
+        remove_entry(cache, cache->tail);
+    pthread_mutex_destroy(&cache->lock);
+}
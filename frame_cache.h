@@ -0,0 +1,44 @@
+#ifndef FRAME_EXTRACTOR_FRAME_CACHE_H
+#define FRAME_EXTRACTOR_FRAME_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <libavutil/frame.h>
+
+struct frame_cache_entry {
+    int stream;
+    int64_t pts;
+    int64_t next_pts;
+    AVFrame *frame;
+    size_t size;
+    struct frame_cache_entry *prev;
+    struct frame_cache_entry *next;
+};
+
+/*
+ * Decoded frames keyed by stream and pts, evicted least recently used first once over the byte budget.
+ * Every entry remembers the pts of the frame decoded right after it, if known, so that a chain of cached frames
+ * can stand in for decoding.
+ */
+struct frame_cache {
+    size_t budget;
+    size_t size;
+    struct AVTreeNode *root;
+    struct frame_cache_entry *head;
+    struct frame_cache_entry *tail;
+    pthread_mutex_t lock;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+void frame_cache_init(struct frame_cache *cache, size_t budget);
+int frame_cache_put(struct frame_cache *cache, int stream, const AVFrame *frame, int64_t prev_pts);
+int frame_cache_find(struct frame_cache *cache, int stream, int64_t ts, int64_t *pts, int64_t *next_pts);
+int frame_cache_get(struct frame_cache *cache, int stream, int64_t pts, AVFrame *frame);
+void frame_cache_miss(struct frame_cache *cache);
+void frame_cache_report(struct frame_cache *cache);
+void frame_cache_free(struct frame_cache *cache);
+
+#endif //FRAME_EXTRACTOR_FRAME_CACHE_H
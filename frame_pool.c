@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include "frame_pool.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#define FRAME_POOL_PADDING (16 + 64 - 1)
+#define HUGE_PAGE_SIZE (2 << 20)
+
+#if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(57, 0, 100)
+typedef int buffer_size_t;
+#else
+typedef size_t buffer_size_t;
+#endif
+
+void frame_pool_init(struct frame_pool *pool, int huge_pages) {
+    memset(pool, 0, sizeof(struct frame_pool));
+    pool->huge_pages = huge_pages;
+    pool->format = AV_PIX_FMT_NONE;
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+
+static void free_huge(void *opaque, uint8_t *data) {
+    (void) opaque;
+    free(data);
+}
+
+/*
+ * Backs a buffer with transparent huge pages, which cuts the TLB misses of the decoder on large frames.
+ * Buffers smaller than a huge page would mostly waste it and are allocated as usual.
+ */
+static AVBufferRef *alloc_buffer(void *opaque, buffer_size_t size) {
+    void *data;
+    AVBufferRef *buf;
+    size_t rounded = ((size_t) size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+    struct frame_pool *pool = opaque;
+
+    if (!pool->huge_pages || (size_t) size < HUGE_PAGE_SIZE)
+        return av_buffer_alloc(size);
+    if (posix_memalign(&data, HUGE_PAGE_SIZE, rounded) != 0)
+        return NULL;
+    madvise(data, rounded, MADV_HUGEPAGE);
+    if ((buf = av_buffer_create(data, size, free_huge, NULL, 0)) == NULL)
+        free(data);
+    return buf;
+}
+
+#else
+
+static AVBufferRef *alloc_buffer(void *opaque, buffer_size_t size) {
+    (void) opaque;
+    return av_buffer_alloc(size);
+}
+
+#endif
+
+/*
+ * Lays out the planes of the frame the way the decoder needs them, with the dimensions and the linesizes
+ * aligned for its SIMD code, and starts a pool of buffers of that size. Buffers still held by frames
+ * of the previous layout stay valid until they are released.
+ */
+static int configure(struct frame_pool *pool, AVCodecContext *codec_ctx, const AVFrame *frame) {
+    int ret, unaligned;
+    int width = frame->width, height = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    uint8_t *data[4];
+
+    avcodec_align_dimensions2(codec_ctx, &width, &height, linesize_align);
+    do {
+        if ((ret = av_image_fill_linesizes(pool->linesize, frame->format, width)) < 0)
+            return ret;
+        width += width & ~(width - 1);
+        unaligned = 0;
+        for (int p = 0; p < 4; p++)
+            unaligned |= pool->linesize[p] % linesize_align[p];
+    } while (unaligned);
+    if ((ret = av_image_fill_pointers(data, frame->format, height, NULL, pool->linesize)) < 0)
+        return ret;
+
+    av_buffer_pool_uninit(&pool->pool);
+    pool->format = AV_PIX_FMT_NONE;
+    if ((pool->pool = av_buffer_pool_init2(ret + FRAME_POOL_PADDING, pool, alloc_buffer, NULL)) == NULL)
+        return AVERROR(ENOMEM);
+    pool->format = frame->format;
+    pool->width = frame->width;
+    pool->height = frame->height;
+    pool->aligned_height = height;
+    return 0;
+}
+
+static int get_buffer(AVCodecContext *codec_ctx, AVFrame *frame, int flags) {
+    int ret;
+    struct frame_pool *pool = codec_ctx->opaque;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+
+    if (desc == NULL || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL)) || frame->width <= 0 ||
+        frame->height <= 0)
+        return avcodec_default_get_buffer2(codec_ctx, frame, flags);
+
+    pthread_mutex_lock(&pool->lock);
+    if ((frame->format != pool->format || frame->width != pool->width || frame->height != pool->height) &&
+        (ret = configure(pool, codec_ctx, frame)) < 0) {
+        pthread_mutex_unlock(&pool->lock);
+        return ret;
+    }
+    frame->buf[0] = av_buffer_pool_get(pool->pool);
+    if (frame->buf[0] != NULL)
+        av_image_fill_pointers(frame->data, frame->format, pool->aligned_height, frame->buf[0]->data, pool->linesize);
+    memcpy(frame->linesize, pool->linesize, sizeof(pool->linesize));
+    pthread_mutex_unlock(&pool->lock);
+    if (frame->buf[0] == NULL)
+        return AVERROR(ENOMEM);
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+/*
+ * Makes the decoder draw its frames from the pool, if it lets the caller allocate them.
+ * Must be called before the decoder is opened.
+ */
+void frame_pool_attach(struct frame_pool *pool, AVCodecContext *codec_ctx) {
+    if (codec_ctx->codec == NULL || !(codec_ctx->codec->capabilities & AV_CODEC_CAP_DR1))
+        return;
+    codec_ctx->opaque = pool;
+    codec_ctx->get_buffer2 = get_buffer;
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(59, 0, 100)
+    codec_ctx->thread_safe_callbacks = 1;
+#endif
+}
+
+void frame_pool_uninit(struct frame_pool *pool) {
+    av_buffer_pool_uninit(&pool->pool);
+    pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,27 @@
+#ifndef FRAME_EXTRACTOR_FRAME_POOL_H
+#define FRAME_EXTRACTOR_FRAME_POOL_H
+
+#include <pthread.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+
+/*
+ * Decoder output buffers drawn from an AVBufferPool, so that the decoder reuses the buffers of the frames
+ * it has released instead of allocating each picture anew. Every buffer holds all the planes of one frame.
+ */
+struct frame_pool {
+    int huge_pages;
+    pthread_mutex_t lock;
+    AVBufferPool *pool;
+    int format;
+    int width;
+    int height;
+    int aligned_height;
+    int linesize[4];
+};
+
+void frame_pool_init(struct frame_pool *pool, int huge_pages);
+void frame_pool_attach(struct frame_pool *pool, AVCodecContext *codec_ctx);
+void frame_pool_uninit(struct frame_pool *pool);
+
+#endif //FRAME_EXTRACTOR_FRAME_POOL_H
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "index.h"
+
+#define INDEX_MAGIC "FXINDEX1"
+
+/*
+ * The sidecar file is a header followed by one index_entry per packet of the video stream, in demuxing order.
+ * Both are written in host byte order; the source size and mtime in the header tell whether it is still valid.
+ */
+struct index_header {
+    char magic[8];
+    int64_t src_size;
+    int64_t src_mtime;
+    int32_t stream_index;
+    int32_t time_base_num;
+    int32_t time_base_den;
+    uint32_t count;
+};
+
+static int compare_keyframes(const void *a, const void *b) {
+    const struct index_entry *entry_a = *(const struct index_entry **) a;
+    const struct index_entry *entry_b = *(const struct index_entry **) b;
+    if (entry_a->pts != entry_b->pts)
+        return entry_a->pts < entry_b->pts ? -1 : 1;
+    return 0;
+}
+
+static int index_add(struct index *index, const struct index_entry *entry) {
+    if (index->count == index->capacity) {
+        unsigned int capacity = index->capacity > 0 ? index->capacity * 2 : 4096;
+        struct index_entry *entries = realloc(index->entries, capacity * sizeof(struct index_entry));
+        if (entries == NULL)
+            return AVERROR(ENOMEM);
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+    index->entries[index->count++] = *entry;
+    return 0;
+}
+
+static int index_finalize(struct index *index) {
+    free(index->keyframes);
+    index->keyframes = malloc((index->count > 0 ? index->count : 1) * sizeof(struct index_entry *));
+    index->keyframe_count = 0;
+    if (index->keyframes == NULL)
+        return AVERROR(ENOMEM);
+    for (unsigned int i = 0; i < index->count; i++) {
+        if ((index->entries[i].flags & AV_PKT_FLAG_KEY) && index->entries[i].pts != AV_NOPTS_VALUE &&
+            index->entries[i].pos >= 0)
+            index->keyframes[index->keyframe_count++] = &index->entries[i];
+    }
+    qsort(index->keyframes, index->keyframe_count, sizeof(struct index_entry *), compare_keyframes);
+    return 0;
+}
+
+static int stat_source(const char *src_filename, int64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat(src_filename, &st) != 0)
+        return AVERROR(errno);
+    *size = (int64_t) st.st_size;
+    *mtime = (int64_t) st.st_mtime;
+    return 0;
+}
+
+void index_init(struct index *index) {
+    index->entries = NULL;
+    index->count = 0;
+    index->capacity = 0;
+    index->keyframes = NULL;
+    index->keyframe_count = 0;
+}
+
+int index_load(struct index *index, const char *filename, const char *src_filename, const AVStream *stream) {
+    struct index_header header;
+    int64_t src_size, src_mtime;
+    int ret;
+    FILE *f;
+
+    if ((ret = stat_source(src_filename, &src_size, &src_mtime)) < 0)
+        return ret;
+    if ((f = fopen(filename, "rb")) == NULL)
+        return AVERROR(errno);
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0) {
+        fclose(f);
+        return AVERROR_INVALIDDATA;
+    }
+    if (header.src_size != src_size || header.src_mtime != src_mtime || header.stream_index != stream->index ||
+        header.time_base_num != stream->time_base.num || header.time_base_den != stream->time_base.den) {
+        fclose(f);
+        return AVERROR_INVALIDDATA;
+    }
+
+    index_free(index);
+    index->entries = malloc((header.count > 0 ? header.count : 1) * sizeof(struct index_entry));
+    if (index->entries == NULL) {
+        fclose(f);
+        return AVERROR(ENOMEM);
+    }
+    index->capacity = header.count;
+    if (fread(index->entries, sizeof(struct index_entry), header.count, f) != header.count) {
+        fclose(f);
+        index_free(index);
+        return AVERROR_INVALIDDATA;
+    }
+    index->count = header.count;
+    fclose(f);
+    return index_finalize(index);
+}
+
+/*
+ * Demuxes the whole source once without decoding, recording every packet of the selected stream.
+ * The source is rewound to its start afterwards.
+ */
+int index_build(struct index *index, AVFormatContext *fmt_ctx, int stream_idx) {
+    AVPacket pkt = {0};
+    int ret;
+
+    index_free(index);
+    while ((ret = av_read_frame(fmt_ctx, &pkt)) >= 0) {
+        if (pkt.stream_index == stream_idx) {
+            struct index_entry entry = {pkt.pts, pkt.dts, pkt.pos, pkt.flags, pkt.size};
+            if ((ret = index_add(index, &entry)) < 0) {
+                av_packet_unref(&pkt);
+                return ret;
+            }
+        }
+        av_packet_unref(&pkt);
+    }
+    if (ret != AVERROR_EOF)
+        return ret;
+    av_seek_frame(fmt_ctx, stream_idx, fmt_ctx->streams[stream_idx]->start_time != AV_NOPTS_VALUE ?
+                                       fmt_ctx->streams[stream_idx]->start_time : 0, AVSEEK_FLAG_BACKWARD);
+    return index_finalize(index);
+}
+
+int index_save(const struct index *index, const char *filename, const char *src_filename, const AVStream *stream) {
+    struct index_header header;
+    int ret;
+    FILE *f;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    if ((ret = stat_source(src_filename, &header.src_size, &header.src_mtime)) < 0)
+        return ret;
+    header.stream_index = stream->index;
+    header.time_base_num = stream->time_base.num;
+    header.time_base_den = stream->time_base.den;
+    header.count = index->count;
+
+    if ((f = fopen(filename, "wb")) == NULL)
+        return AVERROR(errno);
+    if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fwrite(index->entries, sizeof(struct index_entry), index->count, f) != index->count) {
+        fclose(f);
+        remove(filename);
+        return AVERROR(EIO);
+    }
+    if (fclose(f) != 0) {
+        remove(filename);
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+const struct index_entry *index_keyframe_before(const struct index *index, int64_t ts) {
+    unsigned int lo = 0, hi = index->keyframe_count;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (index->keyframes[mid]->pts <= ts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? index->keyframes[lo - 1] : NULL;
+}
+
+const struct index_entry *index_keyframe_after(const struct index *index, int64_t ts) {
+    unsigned int lo = 0, hi = index->keyframe_count;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (index->keyframes[mid]->pts <= ts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < index->keyframe_count ? index->keyframes[lo] : NULL;
+}
+
+void index_free(struct index *index) {
+    free(index->entries);
+    free(index->keyframes);
+    index_init(index);
+}
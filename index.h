@@ -0,0 +1,30 @@
+#ifndef FRAME_EXTRACTOR_INDEX_H
+#define FRAME_EXTRACTOR_INDEX_H
+
+#include <libavformat/avformat.h>
+
+struct index_entry {
+    int64_t pts;
+    int64_t dts;
+    int64_t pos;
+    int32_t flags;
+    int32_t size;
+};
+
+struct index {
+    struct index_entry *entries;
+    unsigned int count;
+    unsigned int capacity;
+    const struct index_entry **keyframes;
+    unsigned int keyframe_count;
+};
+
+void index_init(struct index *index);
+int index_load(struct index *index, const char *filename, const char *src_filename, const AVStream *stream);
+int index_build(struct index *index, AVFormatContext *fmt_ctx, int stream_idx);
+int index_save(const struct index *index, const char *filename, const char *src_filename, const AVStream *stream);
+const struct index_entry *index_keyframe_before(const struct index *index, int64_t ts);
+const struct index_entry *index_keyframe_after(const struct index *index, int64_t ts);
+void index_free(struct index *index);
+
+#endif //FRAME_EXTRACTOR_INDEX_H
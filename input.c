@@ -0,0 +1,274 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include "fetch.h"
+#include "input.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define AVIO_BUFFER_SIZE 65536
+#define READAHEAD_MIN (256 << 10)
+#define READAHEAD_MAX (8 << 20)
+#define PREFETCH_MAX (64 << 20)
+#define HTTP_BLOCKS 64
+#define HTTP_CONNECTIONS 4
+
+void input_init(struct input *input) {
+    input->mode = INPUT_AVIO;
+    input->fd = -1;
+    input->map = NULL;
+    input->size = 0;
+    input->pos = 0;
+    input->readahead_end = 0;
+    input->window = READAHEAD_MIN;
+    input->pb = NULL;
+    input->fetcher = NULL;
+    input->bytes_prefetched = 0;
+}
+
+int input_parse_mode(const char *name, enum input_mode *mode) {
+    if (strcmp(name, "avio") == 0)
+        *mode = INPUT_AVIO;
+    else if (strcmp(name, "pread") == 0)
+        *mode = INPUT_PREAD;
+    else if (strcmp(name, "mmap") == 0)
+        *mode = INPUT_MMAP;
+    else if (strcmp(name, "http") == 0)
+        *mode = INPUT_HTTP;
+    else
+        return AVERROR(EINVAL);
+    return 0;
+}
+
+#ifndef _WIN32
+
+static int open_file(struct input *input, const char *filename) {
+    struct stat st;
+
+    if ((input->fd = open(filename, O_RDONLY)) < 0 || fstat(input->fd, &st) != 0)
+        return AVERROR(errno);
+    input->size = (int64_t) st.st_size;
+    if (input->mode == INPUT_MMAP) {
+        void *map = input->size > 0 ? mmap(NULL, (size_t) input->size, PROT_READ, MAP_SHARED, input->fd, 0)
+                                    : MAP_FAILED;
+        if (map == MAP_FAILED)
+            return input->size > 0 ? AVERROR(errno) : AVERROR_INVALIDDATA;
+        input->map = map;
+        madvise(input->map, (size_t) input->size, MADV_RANDOM);
+    } else {
+#ifdef POSIX_FADV_RANDOM
+        posix_fadvise(input->fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+    }
+    return 0;
+}
+
+static void advise_file(struct input *input, int64_t begin, int64_t end) {
+    if (input->map != NULL) {
+        int64_t page = sysconf(_SC_PAGESIZE);
+        begin -= begin % page;
+        madvise(input->map + begin, (size_t) (end - begin), MADV_WILLNEED);
+    } else {
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(input->fd, (off_t) begin, (off_t) (end - begin), POSIX_FADV_WILLNEED);
+#endif
+    }
+}
+
+static int read_file(struct input *input, uint8_t *buf, int64_t length) {
+    ssize_t n;
+    if (input->map != NULL) {
+        memcpy(buf, input->map + input->pos, (size_t) length);
+        return (int) length;
+    }
+    do {
+        n = pread(input->fd, buf, (size_t) length, (off_t) input->pos);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return AVERROR(errno);
+    return n > 0 ? (int) n : AVERROR_EOF;
+}
+
+static void close_file(struct input *input) {
+    if (input->map != NULL)
+        munmap(input->map, (size_t) input->size);
+    if (input->fd >= 0)
+        close(input->fd);
+}
+
+#else
+
+static int open_file(struct input *input, const char *filename) {
+    (void) input;
+    (void) filename;
+    fprintf(stderr, "The pread and mmap input modes are not supported on this platform\n");
+    return AVERROR(ENOSYS);
+}
+
+static void advise_file(struct input *input, int64_t begin, int64_t end) {
+    (void) input;
+    (void) begin;
+    (void) end;
+}
+
+static int read_file(struct input *input, uint8_t *buf, int64_t length) {
+    (void) input;
+    (void) buf;
+    (void) length;
+    return AVERROR(ENOSYS);
+}
+
+static void close_file(struct input *input) {
+    (void) input;
+}
+
+#endif
+
+/*
+ * Starts reading [begin, end) in the background: the kernel for local files, the fetcher for URLs.
+ */
+static void advise(struct input *input, int64_t begin, int64_t end) {
+    begin = FFMAX(begin, 0);
+    end = FFMIN(end, input->size);
+    if (begin >= end)
+        return;
+    if (input->fetcher != NULL)
+        fetcher_prefetch(input->fetcher, begin, end);
+    else
+        advise_file(input, begin, end);
+}
+
+static int read_packet(void *opaque, uint8_t *buf, int buf_size) {
+    int ret;
+    struct input *input = opaque;
+    int64_t length = FFMIN(buf_size, input->size - input->pos);
+
+    if (length <= 0)
+        return AVERROR_EOF;
+    if (input->pos + length > input->readahead_end - input->window / 2) {
+        int64_t begin = FFMAX(input->pos, input->readahead_end);
+        input->readahead_end = input->pos + length + input->window;
+        advise(input, begin, input->readahead_end);
+        input->window = FFMIN(input->window * 2, READAHEAD_MAX);
+    }
+    if (input->fetcher != NULL)
+        ret = fetcher_read(input->fetcher, input->pos, buf, (int) length);
+    else
+        ret = read_file(input, buf, length);
+    if (ret > 0)
+        input->pos += ret;
+    return ret;
+}
+
+/*
+ * A seek starts the readahead window over at its smallest size, so jumping backwards reads little ahead
+ * until the reads prove to be sequential again.
+ */
+static int64_t seek_input(void *opaque, int64_t offset, int whence) {
+    int64_t pos;
+    struct input *input = opaque;
+
+    if (whence & AVSEEK_SIZE)
+        return input->size;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = input->pos + offset;
+            break;
+        case SEEK_END:
+            pos = input->size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (pos < 0)
+        return AVERROR(EINVAL);
+    if (pos != input->pos) {
+        input->readahead_end = pos;
+        input->window = READAHEAD_MIN;
+    }
+    input->pos = pos;
+    return pos;
+}
+
+/*
+ * Opens filename for the given mode. INPUT_AVIO leaves input->pb unset, so that the path is opened by libavformat.
+ */
+int input_open(struct input *input, const char *filename, enum input_mode mode) {
+    int ret;
+    unsigned char *buffer = NULL;
+
+    input_init(input);
+    input->mode = mode;
+    if (mode == INPUT_AVIO)
+        return 0;
+    if (mode == INPUT_HTTP) {
+        if ((input->fetcher = malloc(sizeof(struct fetcher))) == NULL) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        if ((ret = fetcher_open(input->fetcher, filename, HTTP_BLOCKS, HTTP_CONNECTIONS)) < 0) {
+            free(input->fetcher);
+            input->fetcher = NULL;
+            goto fail;
+        }
+        input->size = fetcher_size(input->fetcher);
+    } else if ((ret = open_file(input, filename)) < 0) {
+        goto fail;
+    }
+
+    if ((buffer = av_malloc(AVIO_BUFFER_SIZE)) == NULL ||
+        (input->pb = avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 0, input, read_packet, NULL, seek_input)) == NULL) {
+        av_free(buffer);
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    return 0;
+
+    fail:
+    input_close(input);
+    return ret;
+}
+
+/*
+ * Prefetches a byte range that the demuxer is about to seek to. An unknown end (negative) prefetches
+ * a full readahead window.
+ */
+void input_prefetch(struct input *input, int64_t begin, int64_t end) {
+    if (input->pb == NULL || begin < 0)
+        return;
+    if (end <= begin)
+        end = begin + READAHEAD_MAX;
+    end = FFMIN(end, begin + PREFETCH_MAX);
+    advise(input, begin, end);
+    input->bytes_prefetched += (uint64_t) (FFMIN(end, input->size) - FFMIN(begin, input->size));
+}
+
+void input_report(struct input *input) {
+    if (input->fetcher != NULL)
+        fetcher_report(input->fetcher);
+}
+
+void input_close(struct input *input) {
+    if (input->pb != NULL) {
+        av_freep(&input->pb->buffer);
+        avio_context_free(&input->pb);
+    }
+    if (input->fetcher != NULL) {
+        fetcher_close(input->fetcher);
+        free(input->fetcher);
+    }
+    close_file(input);
+    input_init(input);
+}
@@ -0,0 +1,39 @@
+#ifndef FRAME_EXTRACTOR_INPUT_H
+#define FRAME_EXTRACTOR_INPUT_H
+
+#include <stdint.h>
+#include <libavformat/avio.h>
+
+enum input_mode {
+    INPUT_AVIO,
+    INPUT_PREAD,
+    INPUT_MMAP,
+    INPUT_HTTP
+};
+
+/*
+ * A source read through a custom AVIOContext: a local file with pread or from a memory mapping, or a URL
+ * through the block cache of a fetcher. The kernel's own readahead is turned off: reads ramp up their own
+ * readahead window after every seek, and the GOPs the plan will seek to next can be prefetched explicitly.
+ */
+struct input {
+    enum input_mode mode;
+    int fd;
+    unsigned char *map;
+    int64_t size;
+    int64_t pos;
+    int64_t readahead_end;
+    int64_t window;
+    AVIOContext *pb;
+    struct fetcher *fetcher;
+    uint64_t bytes_prefetched;
+};
+
+void input_init(struct input *input);
+int input_parse_mode(const char *name, enum input_mode *mode);
+int input_open(struct input *input, const char *filename, enum input_mode mode);
+void input_prefetch(struct input *input, int64_t begin, int64_t end);
+void input_report(struct input *input);
+void input_close(struct input *input);
+
+#endif //FRAME_EXTRACTOR_INPUT_H
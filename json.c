@@ -1,57 +1,101 @@
 #include <stdio.h>
-#include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
 #include "json.h"
 
-static char *read_file(char const *path) {
+static char *read_stream(FILE *f, size_t *length) {
     char *buffer = NULL;
-    size_t length = 0;
-    FILE *f = fopen(path, "rb");
+    size_t capacity = 0;
 
+    *length = 0;
+    for (;;) {
+        if (*length + 1 >= capacity) {
+            char *grown = realloc(buffer, capacity > 0 ? capacity * 2 : 65536);
+            if (grown == NULL) {
+                free(buffer);
+                return NULL;
+            }
+            buffer = grown;
+            capacity = capacity > 0 ? capacity * 2 : 65536;
+        }
+        size_t size = fread(buffer + *length, sizeof(char), capacity - *length - 1, f);
+        if (size == 0)
+            break;
+        *length += size;
+    }
+    return buffer;
+}
+
+static char *read_file(char const *path, size_t *length) {
+    char *buffer = NULL;
+    FILE *f;
+
+    *length = 0;
+    if (strcmp(path, "-") == 0)
+        return read_stream(stdin, length);
+    f = fopen(path, "rb");
     if (f) {
         fseek(f, 0, SEEK_END);
-        length = (size_t) ftell(f);
+        *length = (size_t) ftell(f);
         fseek(f, 0, SEEK_SET);
-        buffer = (char *) malloc((length + 1) * sizeof(char));
+        buffer = (char *) malloc((*length + 1) * sizeof(char));
         if (buffer)
-            fread(buffer, sizeof(char), length, f);
+            *length = fread(buffer, sizeof(char), *length, f);
         fclose(f);
     }
     if (buffer != NULL)
-        buffer[length] = '\0';
+        buffer[*length] = '\0';
     return buffer;
 }
 
-int json_parse(const char *json_filename) {
-    json.buffer = read_file(json_filename);
-    if (json.buffer == NULL)
-        return -4;
+/*
+ * Parses the file in a single pass, growing the token array whenever jsmn runs out of tokens.
+ * jsmn resumes from where it stopped, so the buffer is never scanned twice.
+ */
+int json_parse(struct json *json, const char *json_filename) {
+    size_t length;
+    unsigned int capacity;
     jsmn_parser parser;
+    int ret;
+
+    json->tokens = NULL;
+    json->token_count = 0;
+    json->buffer = read_file(json_filename, &length);
+    if (json->buffer == NULL)
+        return -4;
+    json->buffer[length] = '\0';
+    capacity = (unsigned int) (length / 8 + 64);
     jsmn_init(&parser);
-    json.token_count = (unsigned int) jsmn_parse(&parser, json.buffer, strlen(json.buffer), NULL, 0);
-    json.tokens = malloc((size_t) json.token_count * sizeof(jsmntok_t));
-    jsmn_init(&parser);
-    int ret = jsmn_parse(&parser, json.buffer, strlen(json.buffer), json.tokens, json.token_count);
+    do {
+        jsmntok_t *tokens = realloc(json->tokens, capacity * sizeof(jsmntok_t));
+        if (tokens == NULL) {
+            ret = JSMN_ERROR_NOMEM;
+            break;
+        }
+        json->tokens = tokens;
+        ret = jsmn_parse(&parser, json->buffer, length, json->tokens, capacity);
+        capacity *= 2;
+    } while (ret == JSMN_ERROR_NOMEM);
     if (ret < 0) {
-        free(json.buffer);
-        free(json.tokens);
-        json.buffer = NULL;
-        json.tokens = NULL;
+        free(json->buffer);
+        free(json->tokens);
+        json->buffer = NULL;
+        json->tokens = NULL;
     }
-    json.token_count = (unsigned int) (ret > 0 ? ret : 0);
+    json->token_count = (unsigned int) (ret > 0 ? ret : 0);
     return ret;
 }
 
-char *json_buffer() {
-    return json.buffer;
+char *json_buffer(const struct json *json) {
+    return json->buffer;
 }
 
-jsmntok_t json_token(int index) {
-    return json.tokens[index];
+jsmntok_t json_token(const struct json *json, int index) {
+    return json->tokens[index];
 }
 
-unsigned int json_token_count() {
-    return json.token_count;
+unsigned int json_token_count(const struct json *json) {
+    return json->token_count;
 }
 
 char *json_err2str(int err) {
@@ -69,9 +113,12 @@ char *json_err2str(int err) {
     }
 }
 
-void json_free() {
-    if (json.buffer != NULL)
-        free(json.buffer);
-    if (json.tokens != NULL)
-        free(json.tokens);
+void json_free(struct json *json) {
+    if (json->buffer != NULL)
+        free(json->buffer);
+    if (json->tokens != NULL)
+        free(json->tokens);
+    json->buffer = NULL;
+    json->tokens = NULL;
+    json->token_count = 0;
 }
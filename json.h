@@ -3,17 +3,17 @@
 
 #include "jsmn.h"
 
-struct {
+struct json {
     char *buffer;
     jsmntok_t *tokens;
     unsigned int token_count;
-} static json;
+};
 
-int json_parse(const char *json_filename);
-char *json_buffer();
-jsmntok_t json_token(int index);
-unsigned int json_token_count();
+int json_parse(struct json *json, const char *json_filename);
+char *json_buffer(const struct json *json);
+jsmntok_t json_token(const struct json *json, int index);
+unsigned int json_token_count(const struct json *json);
 char *json_err2str(int err);
-void json_free();
+void json_free(struct json *json);
 
 #endif //FRAME_EXTRACTOR_JSON_H
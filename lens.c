@@ -0,0 +1,256 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/cpu.h>
+#include <libavutil/pixdesc.h>
+#include "lens.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_LENS_AVX2 1
+#include <immintrin.h>
+#else
+#define HAVE_LENS_AVX2 0
+#endif
+
+/*
+ * Radial distortion correction with the same model as the lenscorrection filter (centre at 0.5, 0.5):
+ * every output pixel is sampled from the source at 1 + k1 * r^2 + k2 * r^4 times its distance from the centre.
+ * The sampling positions are computed once per frame geometry and stored per plane as the top-left source pixel
+ * and 7-bit bilinear weights. Pixels mapped outside the source get the plane's fill value.
+ */
+
+#define WEIGHT_BITS 7
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+
+struct remap_job {
+    struct lens *lens;
+    const AVFrame *in;
+    AVFrame *out;
+};
+
+static void remap_row_c(const struct lens_plane *plane, int offset, const uint8_t *src, int src_linesize,
+                        uint8_t *dst, int start) {
+    for (int i = start; i < plane->width; i++) {
+        int x = plane->x[offset + i];
+        if (x < 0) {
+            dst[i] = plane->fill;
+        } else {
+            const uint8_t *p = src + plane->y[offset + i] * src_linesize + x;
+            int fx = plane->fx[offset + i], fy = plane->fy[offset + i];
+            int top = p[0] * (WEIGHT_ONE - fx) + p[1] * fx;
+            int bottom = p[src_linesize] * (WEIGHT_ONE - fx) + p[src_linesize + 1] * fx;
+            dst[i] = (uint8_t) ((top * (WEIGHT_ONE - fy) + bottom * fy + (1 << (2 * WEIGHT_BITS - 1))) >>
+                                (2 * WEIGHT_BITS));
+        }
+    }
+}
+
+#if HAVE_LENS_AVX2
+/*
+ * Eight pixels at a time: one masked 32-bit gather per source row fetches both horizontal neighbours.
+ * The gather reads four bytes, so it starts two bytes to the left of the pixel, unless that is before the row:
+ * the bytes it reads then always lie within the plane width, whatever the linesize and padding of the frame.
+ */
+__attribute__((target("avx2")))
+static void remap_row_avx2(const struct lens_plane *plane, int offset, const uint8_t *src, int src_linesize,
+                           uint8_t *dst) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i minus_one = _mm256_set1_epi32(-1);
+    const __m256i one_int = _mm256_set1_epi32(1);
+    const __m256i two = _mm256_set1_epi32(2);
+    const __m256i byte_mask = _mm256_set1_epi32(0xff);
+    const __m256i one = _mm256_set1_epi32(WEIGHT_ONE);
+    const __m256i round = _mm256_set1_epi32(1 << (2 * WEIGHT_BITS - 1));
+    const __m256i fill = _mm256_set1_epi32(plane->fill);
+    const __m256i linesize = _mm256_set1_epi32(src_linesize);
+    const __m256i shuffle = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    int i = 0;
+
+    for (; i + 8 <= plane->width; i += 8) {
+        __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (plane->x + offset + i)));
+        __m256i y = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (plane->y + offset + i)));
+        __m256i fx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (plane->fx + offset + i)));
+        __m256i fy = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (plane->fy + offset + i)));
+        __m256i valid = _mm256_cmpgt_epi32(x, minus_one);
+        __m256i back = _mm256_and_si256(_mm256_cmpgt_epi32(x, one_int), two);
+        __m256i shift = _mm256_slli_epi32(back, 3);
+        __m256i index = _mm256_sub_epi32(_mm256_add_epi32(_mm256_mullo_epi32(y, linesize), x), back);
+        __m256i top = _mm256_mask_i32gather_epi32(zero, (const int *) src, index, valid, 1);
+        __m256i bottom = _mm256_mask_i32gather_epi32(zero, (const int *) (src + src_linesize), index, valid, 1);
+        __m256i fx_inv = _mm256_sub_epi32(one, fx);
+        __m256i fy_inv = _mm256_sub_epi32(one, fy);
+
+        top = _mm256_srlv_epi32(top, shift);
+        bottom = _mm256_srlv_epi32(bottom, shift);
+
+        top = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(top, byte_mask), fx_inv),
+                               _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(top, 8), byte_mask), fx));
+        bottom = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(bottom, byte_mask), fx_inv),
+                                  _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(bottom, 8), byte_mask), fx));
+        __m256i result = _mm256_add_epi32(_mm256_mullo_epi32(top, fy_inv), _mm256_mullo_epi32(bottom, fy));
+        result = _mm256_srli_epi32(_mm256_add_epi32(result, round), 2 * WEIGHT_BITS);
+        result = _mm256_blendv_epi8(fill, result, valid);
+        result = _mm256_shuffle_epi8(result, shuffle);
+
+        uint32_t low = (uint32_t) _mm_cvtsi128_si32(_mm256_castsi256_si128(result));
+        uint32_t high = (uint32_t) _mm_cvtsi128_si32(_mm256_extracti128_si256(result, 1));
+        memcpy(dst + i, &low, 4);
+        memcpy(dst + i + 4, &high, 4);
+    }
+    remap_row_c(plane, offset, src, src_linesize, dst, i);
+}
+#endif
+
+static void remap_band(void *arg, int index, int count) {
+    struct remap_job *job = arg;
+    struct lens *lens = job->lens;
+#if HAVE_LENS_AVX2
+    int avx2 = (av_get_cpu_flags() & AV_CPU_FLAG_AVX2) != 0;
+#endif
+
+    for (int p = 0; p < lens->plane_count; p++) {
+        const struct lens_plane *plane = &lens->planes[p];
+        int start = plane->height * index / count;
+        int end = plane->height * (index + 1) / count;
+        for (int j = start; j < end; j++) {
+            uint8_t *dst = job->out->data[p] + j * job->out->linesize[p];
+#if HAVE_LENS_AVX2
+            if (avx2) {
+                remap_row_avx2(plane, j * plane->width, job->in->data[p], job->in->linesize[p], dst);
+                continue;
+            }
+#endif
+            remap_row_c(plane, j * plane->width, job->in->data[p], job->in->linesize[p], dst, 0);
+        }
+    }
+}
+
+static void free_plane(struct lens_plane *plane) {
+    free(plane->x);
+    free(plane->y);
+    free(plane->fx);
+    free(plane->fy);
+    av_buffer_pool_uninit(&plane->pool);
+    memset(plane, 0, sizeof(struct lens_plane));
+}
+
+static int build_plane(struct lens_plane *plane, int width, int height, double k1, double k2) {
+    size_t size = (size_t) width * height;
+    double x_center = 0.5 * width, y_center = 0.5 * height;
+    double r2_inv = 4.0 / ((double) width * width + (double) height * height);
+
+    plane->width = width;
+    plane->height = height;
+    plane->x = malloc(size * sizeof(int16_t));
+    plane->y = malloc(size * sizeof(int16_t));
+    plane->fx = malloc(size);
+    plane->fy = malloc(size);
+    plane->linesize = FFALIGN(width, 64);
+    plane->pool = av_buffer_pool_init(plane->linesize * height + AV_INPUT_BUFFER_PADDING_SIZE, av_buffer_alloc);
+    if (!plane->x || !plane->y || !plane->fx || !plane->fy || !plane->pool)
+        return AVERROR(ENOMEM);
+
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            size_t offset = (size_t) j * width + i;
+            double off_x = i - x_center, off_y = j - y_center;
+            double r2 = (off_x * off_x + off_y * off_y) * r2_inv;
+            double radius_mult = 1.0 + k1 * r2 + k2 * r2 * r2;
+            double x = x_center + radius_mult * off_x, y = y_center + radius_mult * off_y;
+            if (x < 0 || y < 0 || x > width - 1 || y > height - 1) {
+                plane->x[offset] = -1;
+                plane->y[offset] = 0;
+                plane->fx[offset] = 0;
+                plane->fy[offset] = 0;
+                continue;
+            }
+            int x0 = FFMIN((int) x, width - 2), y0 = FFMIN((int) y, height - 2);
+            plane->x[offset] = (int16_t) x0;
+            plane->y[offset] = (int16_t) y0;
+            plane->fx[offset] = (uint8_t) lrint((x - x0) * WEIGHT_ONE);
+            plane->fy[offset] = (uint8_t) lrint((y - y0) * WEIGHT_ONE);
+        }
+    }
+    return 0;
+}
+
+static int configure(struct lens *lens, const AVFrame *frame) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    int ret;
+
+    if (!desc || !(desc->flags & AV_PIX_FMT_FLAG_PLANAR) || (desc->flags & AV_PIX_FMT_FLAG_RGB) ||
+        desc->comp[0].depth != 8 || frame->width < 2 || frame->height < 2 || frame->width > INT16_MAX ||
+        frame->height > INT16_MAX) {
+        fprintf(stderr, "Lens correction supports only 8-bit planar YUV and gray frames\n");
+        return AVERROR(ENOSYS);
+    }
+    for (int p = 0; p < LENS_MAX_PLANES; p++)
+        free_plane(&lens->planes[p]);
+    lens->width = frame->width;
+    lens->height = frame->height;
+    lens->format = frame->format;
+    lens->plane_count = av_pix_fmt_count_planes(frame->format);
+    for (int p = 0; p < lens->plane_count; p++) {
+        int chroma = (p == 1 || p == 2) && desc->nb_components >= 3;
+        int width = chroma ? -((-frame->width) >> desc->log2_chroma_w) : frame->width;
+        int height = chroma ? -((-frame->height) >> desc->log2_chroma_h) : frame->height;
+        if (width < 2 || height < 2) {
+            fprintf(stderr, "Frame too small for lens correction\n");
+            return AVERROR(EINVAL);
+        }
+        if ((ret = build_plane(&lens->planes[p], width, height, lens->k1, lens->k2)) < 0)
+            return ret;
+        lens->planes[p].fill = (uint8_t) (chroma ? 128 : 0);
+    }
+    return 0;
+}
+
+void lens_init(struct lens *lens, double k1, double k2, int threads) {
+    memset(lens, 0, sizeof(struct lens));
+    lens->k1 = k1;
+    lens->k2 = k2;
+    lens->threads = threads > 0 ? threads : av_cpu_count();
+    lens->format = -1;
+    band_pool_init(&lens->workers, lens->threads);
+}
+
+/*
+ * Writes the corrected copy of `in` into `out`, whose buffers come from the lens' pools.
+ * The maps are rebuilt only when the frame geometry or format changes.
+ */
+int lens_apply(struct lens *lens, const AVFrame *in, AVFrame *out) {
+    int ret;
+    int count = FFMAX(1, FFMIN(lens->threads, in->height / 64));
+    struct remap_job job = {lens, in, out};
+
+    if (in->width != lens->width || in->height != lens->height || in->format != lens->format) {
+        if ((ret = configure(lens, in)) < 0)
+            return ret;
+    }
+
+    av_frame_unref(out);
+    out->format = in->format;
+    out->width = in->width;
+    out->height = in->height;
+    for (int p = 0; p < lens->plane_count; p++) {
+        if ((out->buf[p] = av_buffer_pool_get(lens->planes[p].pool)) == NULL)
+            return AVERROR(ENOMEM);
+        out->data[p] = out->buf[p]->data;
+        out->linesize[p] = lens->planes[p].linesize;
+    }
+    out->extended_data = out->data;
+    if ((ret = av_frame_copy_props(out, in)) < 0)
+        return ret;
+
+    band_pool_run(&lens->workers, remap_band, &job, count);
+    return 0;
+}
+
+void lens_uninit(struct lens *lens) {
+    for (int p = 0; p < LENS_MAX_PLANES; p++)
+        free_plane(&lens->planes[p]);
+    lens->format = -1;
+    band_pool_uninit(&lens->workers);
+}
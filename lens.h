@@ -0,0 +1,38 @@
+#ifndef FRAME_EXTRACTOR_LENS_H
+#define FRAME_EXTRACTOR_LENS_H
+
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include "band_pool.h"
+
+#define LENS_MAX_PLANES 4
+
+struct lens_plane {
+    int width;
+    int height;
+    int16_t *x;
+    int16_t *y;
+    uint8_t *fx;
+    uint8_t *fy;
+    uint8_t fill;
+    AVBufferPool *pool;
+    int linesize;
+};
+
+struct lens {
+    double k1;
+    double k2;
+    int threads;
+    int width;
+    int height;
+    int format;
+    int plane_count;
+    struct lens_plane planes[LENS_MAX_PLANES];
+    struct band_pool workers;
+};
+
+void lens_init(struct lens *lens, double k1, double k2, int threads);
+int lens_apply(struct lens *lens, const AVFrame *in, AVFrame *out);
+void lens_uninit(struct lens *lens);
+
+#endif //FRAME_EXTRACTOR_LENS_H
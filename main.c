@@ -1,30 +1,47 @@
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 #include <getopt.h>
-#include <libavfilter/avfilter.h>
-#include <libavfilter/buffersink.h>
-#include <libavfilter/buffersrc.h>
 #include <libavformat/avformat.h>
-#include <libavutil/parseutils.h>
-#include "json.h"
-
-static int stop_signal = 0;
-static unsigned int framerate = 1, quality = 70, enable_lenscorrection = 0;
+#include "batch.h"
+#include "extractor.h"
+#include "server.h"
+#include "timestamps.h"
+#include "writer.h"
+
+#define JOBS_MAX 256
+#define BATCH_WORKERS_MAX 256
+#define THREADS_MAX 64
+#define PLAN_WINDOW 65536
+#define CACHE_SIZE_MAX 1024
+#define FRAME_CACHE_MAX 65536
+#define WRITE_BUFFER_MAX 1024
+#define WRITE_DEPTH 4
+#define DIMENSION_MAX 16384
+#define PROGRESS_INTERVAL_MAX 3600
+
+static volatile int stop_signal = 0;
+static unsigned int framerate = 1;
 static unsigned long size_limit = 0;
-static double lenscorrection_k1 = -0.125;
-static const char *src_filename = NULL, *dst_filename = NULL, *json_filename = NULL;
-static AVFormatContext *src_fmt_ctx = NULL;
+static unsigned int cache_size = 16;
+static unsigned int batch_workers = 0;
+static size_t write_buffer_size = 0;
+static int write_sync = 0;
+static struct writer writer;
+static const char *report_filename = NULL;
+static struct stats report_stats;
+static unsigned int progress_interval = 0;
+static int64_t run_start = 0;
+static int64_t progress_last = 0;
+static const char *src_filename = NULL, *dst_filename = NULL, *times_filename = NULL, *socket_filename = NULL,
+        *manifest_filename = NULL;
+static enum timestamps_format times_format = TIMESTAMPS_JSON;
+static struct extractor *extractor = NULL;
 static AVFormatContext *dst_fmt_ctx = NULL;
-static AVCodecContext *src_codec_ctx = NULL;
-static AVCodecContext *dst_codec_ctx = NULL;
-static AVStream *src_stream = NULL;
+static const AVCodecParameters *dst_codecpar = NULL;
+static AVRational dst_time_base;
 static AVStream *dst_stream = NULL;
-static AVFilterGraph *filter_graph = NULL;
-static AVFilterContext *buffersrc_ctx = NULL;
-static AVFilterContext *filter_ctx = NULL;
-static AVFilterContext *buffersink_ctx = NULL;
-static int src_video_stream_idx = -1;
-static int frame_filtered = 0;
 static char dst_current_filename[1024];
 static unsigned long dst_current_file = 0;
 static unsigned long dst_current_frame_count = 0;
@@ -32,278 +49,262 @@ static unsigned long dst_current_bytes_written = 0;
 static unsigned long dst_total_frame_count = 0;
 static unsigned long dst_total_bytes_written = 0;
 
-static int init_filter_graph() {
-    char in_args[512];
-    char lenscorrection_args[512];
-    int ret;
-
-    const AVFilter *buffersrc = avfilter_get_by_name("buffer");
-    const AVFilter *lenscorrection = avfilter_get_by_name("lenscorrection");
-    const AVFilter *buffersink = avfilter_get_by_name("buffersink");
-
-    filter_graph = avfilter_graph_alloc();
-
-    AVFilterInOut *inputs = avfilter_inout_alloc();
-    AVFilterInOut *outputs = avfilter_inout_alloc();
-
-    fprintf(stderr, "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d\n",
-           dst_codec_ctx->width, dst_codec_ctx->height, dst_codec_ctx->pix_fmt,
-           dst_codec_ctx->time_base.num, dst_codec_ctx->time_base.den,
-           dst_codec_ctx->sample_aspect_ratio.num, dst_codec_ctx->sample_aspect_ratio.den);
-    fflush(stderr);
-    snprintf(in_args, sizeof(in_args), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
-             dst_codec_ctx->width, dst_codec_ctx->height, dst_codec_ctx->pix_fmt,
-             dst_codec_ctx->time_base.num, dst_codec_ctx->time_base.den,
-             dst_codec_ctx->sample_aspect_ratio.num, dst_codec_ctx->sample_aspect_ratio.den);
-    ret = avfilter_graph_create_filter(&buffersrc_ctx, buffersrc, "in", in_args, NULL, filter_graph);
-    if (ret < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Cannot create buffer source: %s\n", av_err2str(ret));
-        return ret;
-    }
-
-    snprintf(lenscorrection_args, sizeof(lenscorrection_args), "cx=0.5:cy=0.5:k1=%f:k2=-0.012", lenscorrection_k1);
-    ret = avfilter_graph_create_filter(&filter_ctx, lenscorrection, NULL, lenscorrection_args, NULL, filter_graph);
-    if (ret < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Cannot create lenscorrection filter\n");
-        return ret;
-    }
-
-    ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out", NULL, NULL, filter_graph);
-
-    outputs->name = av_strdup("in");
-    outputs->filter_ctx = buffersrc_ctx;
-    outputs->pad_idx = 0;
-    outputs->next = NULL;
-
-    inputs->name = av_strdup("out");
-    inputs->filter_ctx = buffersink_ctx;
-    inputs->pad_idx = 0;
-    inputs->next = NULL;
-
-    if (ret >= 0) ret = avfilter_link(buffersrc_ctx, 0, filter_ctx, 0);
-    if (ret >= 0) ret = avfilter_link(filter_ctx, 0, buffersink_ctx, 0);
-    if (ret < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Error connecting filters\n");
-        return ret;
-    }
-
-    if ((ret = avfilter_graph_config(filter_graph, NULL)) < 0)
-        return ret;
-    return 0;
-
+static int close_dst_io() {
+    if (write_buffer_size > 0)
+        return writer_close(&writer, &dst_fmt_ctx->pb);
+    return avio_closep(&dst_fmt_ctx->pb);
 }
 
-static int open_src(AVFormatContext *fmt_ctx, enum AVMediaType type) {
-    int ret;
-    AVCodec *dec = NULL;
-    AVDictionary *opts = NULL;
-
-    ret = av_find_best_stream(fmt_ctx, type, -1, -1, &dec, 0);
-    if (ret < 0) {
-        fprintf(stderr, "Could not find %s stream in input file '%s'\n",
-                av_get_media_type_string(type), src_filename);
-        return ret;
-    } else {
-        AVStream *st;
-        int stream_idx = ret;
-        st = fmt_ctx->streams[stream_idx];
-
-        src_codec_ctx = avcodec_alloc_context3(dec);
-        if (!src_codec_ctx) {
-            fprintf(stderr, "Failed to allocate codec\n");
-            return AVERROR(EINVAL);
-        }
-
-        ret = avcodec_parameters_to_context(src_codec_ctx, st->codecpar);
-        if (ret < 0) {
-            fprintf(stderr, "Failed to copy codec parameters to codec context\n");
-            return ret;
-        }
-
-        if ((ret = avcodec_open2(src_codec_ctx, dec, &opts)) < 0) {
-            fprintf(stderr, "Failed to open %s codec\n",
-                    av_get_media_type_string(type));
-            return ret;
-        }
-
-        src_video_stream_idx = stream_idx;
-        src_stream = fmt_ctx->streams[src_video_stream_idx];
-    }
-
-    return 0;
-}
-
-static int open_dst(const char *codec) {
+/*
+ * Opens the muxer of the next output file. Only the muxer and its AVIO context are per file: the packets come
+ * already encoded from the single encoder of the extractor.
+ */
+static int open_dst() {
     int ret = 0;
-    AVCodec *encoder = avcodec_find_encoder_by_name(codec);
-    if (!encoder) {
-        av_log(NULL, AV_LOG_FATAL, "Necessary encoder not found\n");
-        return AVERROR_INVALIDDATA;
-    }
     sprintf(dst_current_filename, dst_filename, dst_current_file);
     avformat_alloc_output_context2(&dst_fmt_ctx, NULL, NULL, dst_current_filename);
     if (!dst_fmt_ctx) {
         av_log(NULL, AV_LOG_ERROR, "Could not create output context\n");
         return AVERROR_UNKNOWN;
     }
-    dst_stream = avformat_new_stream(dst_fmt_ctx, encoder);
+    dst_stream = avformat_new_stream(dst_fmt_ctx, NULL);
     if (!dst_stream) {
         av_log(NULL, AV_LOG_ERROR, "Failed allocating output stream\n");
-        return AVERROR_UNKNOWN;
+        ret = AVERROR_UNKNOWN;
+        goto fail;
     }
-    dst_codec_ctx = avcodec_alloc_context3(encoder);
-    dst_codec_ctx->qmax = 129 - (int) round(quality * 1.28);
-    dst_codec_ctx->qmin = dst_codec_ctx->qmax;
-    dst_codec_ctx->height = src_codec_ctx->height;
-    dst_codec_ctx->width = src_codec_ctx->width;
-    dst_codec_ctx->sample_aspect_ratio = src_codec_ctx->sample_aspect_ratio;
-    if (encoder->pix_fmts)
-        dst_codec_ctx->pix_fmt = encoder->pix_fmts[0];
-    else
-        dst_codec_ctx->pix_fmt = src_codec_ctx->pix_fmt;
-    dst_codec_ctx->time_base = (AVRational) {1, framerate};
-    dst_codec_ctx->framerate = (AVRational) {framerate, 1};
-    avcodec_parameters_from_context(dst_stream->codecpar, dst_codec_ctx);
-    dst_stream->time_base = dst_codec_ctx->time_base;
+    if ((ret = avcodec_parameters_copy(dst_stream->codecpar, dst_codecpar)) < 0)
+        goto fail;
+    dst_stream->time_base = dst_time_base;
     dst_stream->avg_frame_rate = (AVRational) {1, 1};
-    dst_stream->sample_aspect_ratio = dst_codec_ctx->sample_aspect_ratio;
+    dst_stream->sample_aspect_ratio = dst_codecpar->sample_aspect_ratio;
 
-    if ((ret = avcodec_open2(dst_codec_ctx, encoder, NULL)) != 0) {
-        fprintf(stderr, "Failed to open output codec: %s\n", av_err2str(ret));
-        return ret;
-    }
-    if ((ret = avio_open(&dst_fmt_ctx->pb, dst_current_filename, AVIO_FLAG_WRITE)) != 0) {
+    if (write_buffer_size > 0)
+        ret = writer_open(&writer, &dst_fmt_ctx->pb, dst_current_filename);
+    else
+        ret = avio_open(&dst_fmt_ctx->pb, dst_current_filename, AVIO_FLAG_WRITE);
+    if (ret != 0) {
         fprintf(stderr, "Failed to open the output file: %s\n", av_err2str(ret));
-        return ret;
+        goto fail;
     }
 
-    if ((ret = avformat_write_header(dst_fmt_ctx, NULL)) != 0) {
+    if ((ret = avformat_write_header(dst_fmt_ctx, NULL)) < 0) {
         fprintf(stderr, "Failed to write output header: %s\n", av_err2str(ret));
-        return ret;
+        goto fail;
     }
+    return 0;
+
+    fail:
+    close_dst_io();
+    avformat_free_context(dst_fmt_ctx);
+    dst_fmt_ctx = NULL;
     return ret;
 }
 
+/*
+ * Finishes the current output file. The muxer is freed even if writing the trailer fails.
+ */
 static int close_dst() {
-    int ret = 0;
+    int ret = 0, close_ret;
     if (dst_fmt_ctx == NULL) {
         return ret;
     }
-    if ((ret = av_write_trailer(dst_fmt_ctx)) != 0) {
+    if ((ret = av_write_trailer(dst_fmt_ctx)) != 0)
         fprintf(stderr, "Failed to write output trailer: %s\n", av_err2str(ret));
-        return ret;
+    if ((close_ret = close_dst_io()) != 0) {
+        fprintf(stderr, "Failed to close the output file: %s\n", av_err2str(close_ret));
+        if (ret == 0)
+            ret = close_ret;
     }
-    if ((ret = avio_close(dst_fmt_ctx->pb)) != 0) {
-        fprintf(stderr, "Failed to close the output file: %s\n", av_err2str(ret));
-        return ret;
-    };
     avformat_free_context(dst_fmt_ctx);
     dst_fmt_ctx = NULL;
+    return ret;
 }
 
-static int write_frame(AVFrame *frame) {
-    int ret = 0;
-    AVPacket packet = {0};
-    if (dst_current_frame_count == 0) {
-        if ((ret = open_dst("mjpeg")) < 0) {
-            fprintf(stderr, "Could not open the destination file: %s\n", av_err2str(ret));
-            return ret;
+/*
+ * Moves on to the next output file, which is opened by the next write.
+ */
+static int rotate_dst() {
+    int ret = close_dst();
+    dst_current_frame_count = 0;
+    dst_current_bytes_written = 0;
+    dst_current_file++;
+    return ret;
+}
+
+/*
+ * Prints the output totals at most once every progress_interval seconds. Runs on the output thread.
+ */
+static void report_progress() {
+    int64_t now = av_gettime_relative();
+    if (now - progress_last < (int64_t) progress_interval * 1000000)
+        return;
+    progress_last = now;
+    fprintf(stderr, "Progress: %lu frames in %.1f s, %.1f fps, %.1f MiB written\n", dst_total_frame_count,
+            (now - run_start) / 1e+6, now > run_start ? dst_total_frame_count * 1e+6 / (now - run_start) : 0.0,
+            dst_total_bytes_written / 1048576.0);
+}
+
+/*
+ * Writes a packet from the extractor, rolling over to the next output file when the size limit would be exceeded.
+ * The packet that does not fit is written as it is into the next file, nothing is encoded again.
+ * Runs on the output thread of the extractor.
+ */
+static int write_packet(void *opaque, AVPacket *packet) {
+    int ret;
+    int packet_size = packet->size;
+    int64_t ts = packet->pts;
+    (void) opaque;
+
+    if (size_limit > 0 && dst_current_bytes_written + packet_size >= size_limit) {
+        if (dst_current_frame_count < 1) {
+            fprintf(stderr, "Frame size greater than size limit\n");
+            return AVERROR(EFBIG);
         }
-    }
-    if (filter_graph == NULL)
-        init_filter_graph();
-    frame->pts = packet.dts = dst_current_frame_count + 1;
-    if (enable_lenscorrection && !frame_filtered) {
-        frame_filtered = 1;
-        if ((ret = av_buffersrc_add_frame_flags(buffersrc_ctx, frame, AV_BUFFERSRC_FLAG_KEEP_REF)) < 0) {
-            av_log(NULL, AV_LOG_ERROR, "Error while feeding the filtergraph\n");
+        if ((ret = rotate_dst()) != 0)
             return ret;
-        }
-        if ((ret = av_buffersink_get_frame(buffersink_ctx, frame)) < 0) {
-            av_log(NULL, AV_LOG_ERROR, "Error while reading from the filtergraph\n");
+    }
+    if (dst_current_frame_count == 0) {
+        if ((ret = open_dst()) < 0) {
+            fprintf(stderr, "Could not open the destination file: %s\n", av_err2str(ret));
             return ret;
         }
-        while (ret >= 0) {
-            ret = av_buffersink_get_frame(buffersink_ctx, NULL);
-        }
     }
-    if ((ret = avcodec_send_frame(dst_codec_ctx, frame)) != 0) {
-        fprintf(stderr, "Failed to send a frame for encoding: %s\n", av_err2str(ret));
+
+    packet->pts = packet->dts = av_rescale_q(dst_current_frame_count + 1, dst_time_base, dst_stream->time_base);
+    if ((ret = av_interleaved_write_frame(dst_fmt_ctx, packet)) != 0) {
+        fprintf(stderr, "Failed to write output frame: %s\n", av_err2str(ret));
         return ret;
     }
-    while ((ret = avcodec_receive_packet(dst_codec_ctx, &packet)) >= 0) {
-        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-            break;
-        else if (ret < 0) {
-            fprintf(stderr, "Error during encoding: %s\n", av_err2str(ret));
-            return ret;
-        }
-
-        int packet_size = packet.size;
-
-        if (size_limit > 0 && dst_current_bytes_written + packet_size >= size_limit) {
-            close_dst();
-            av_packet_unref(&packet);
-            if (dst_current_frame_count < 1) {
-                fprintf(stderr, "Frame size grater than size limit\n");
-                return -1;
-            }
-            dst_current_frame_count = 0;
-            dst_current_bytes_written = 0;
-            dst_current_file++;
-            return write_frame(frame);
-        }
-
-        if (packet.pts != AV_NOPTS_VALUE)
-            packet.pts = av_rescale_q(packet.pts, dst_codec_ctx->time_base, dst_stream->time_base);
-        if (packet.dts != AV_NOPTS_VALUE)
-            packet.dts = av_rescale_q(packet.dts, dst_codec_ctx->time_base, dst_stream->time_base);
 
-        if ((ret = av_interleaved_write_frame(dst_fmt_ctx, &packet)) != 0) {
-            fprintf(stderr, "Failed to write output frame: %s\n", av_err2str(ret));
-            av_packet_unref(&packet);
-            return ret;
-        }
-
-        frame_filtered = 0;
-        dst_current_frame_count++;
-        dst_total_frame_count++;
-        dst_total_bytes_written += packet_size;
-        dst_current_bytes_written += packet_size;
+    dst_current_frame_count++;
+    dst_total_frame_count++;
+    dst_total_bytes_written += packet_size;
+    dst_current_bytes_written += packet_size;
+    fprintf(stderr, "%ld %.3f %s\n", dst_total_frame_count, ts / 1e+6, dst_current_filename);
+    if (progress_interval > 0)
+        report_progress();
+    return 0;
+}
 
-        av_packet_unref(&packet);
+/*
+ * Writes the JSON run report into report_filename, or to stdout for -.
+ */
+static int write_report() {
+    int ret;
+    FILE *file = strcmp(report_filename, "-") == 0 ? stdout : fopen(report_filename, "w");
+    if (file == NULL) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not open the report file %s: %s\n", report_filename, av_err2str(ret));
+        return ret;
     }
-    return 0;
+    report_stats.bytes_written += dst_total_bytes_written;
+    ret = stats_write_json(&report_stats, (av_gettime_relative() - run_start) / 1e+6, file);
+    if (file != stdout && fclose(file) != 0 && ret == 0)
+        ret = AVERROR(errno);
+    if (ret < 0)
+        fprintf(stderr, "Could not write the report: %s\n", av_err2str(ret));
+    return ret;
 }
 
 static void print_usage(const char *self) {
-    fprintf(stderr, "Usage: %s [OPTION]... <INPUT> <JSON> <OUTPUT>\n"
+    fprintf(stderr, "Usage: %s [OPTION]... <INPUT> <TIMES> <OUTPUT>\n"
+                    "       %s [OPTION]... -L <SOCKET>\n"
+                    "       %s [OPTION]... -B <MANIFEST>\n"
                     "\n"
                     "  -h              show help and exit\n"
+                    "  -b MIB          write the output through MIB MiB blocks on a background thread\n"
+                    "  -B, --batch MANIFEST\n"
+                    "                  run the jobs of MANIFEST (or -), one INPUT TIMES OUTPUT line each,\n"
+                    "                  separated by tabs or spaces, on a pool of workers; encoders are reused\n"
+                    "                  between jobs of the same output size, and the throughput of every job\n"
+                    "                  is printed\n"
+                    "  -C 1..1024      number of opened sources kept by the server (default 16)\n"
+                    "  -d 0..64        decoder threads per worker, 0 to share the CPU cores between workers (default)\n"
+                    "  -D TYPE         decoder threading: frame, slice or auto (default)\n"
+                    "  -e 0..64        encoder slice threads, 0 for one per CPU core (default)\n"
                     "  -f 1..60        output framerate\n"
+                    "  -F FORMAT       format of TIMES: json (default), text (one integer of microseconds per line)\n"
+                    "                  or binary (little-endian 64-bit integers of microseconds)\n"
+                    "  -H PIXELS       output height, following the aspect ratio of the input without -W\n"
+                    "  -I MODE         input reads: avio (default), pread or mmap, with readahead tuned for seeking\n"
+                    "                  and the next GOPs prefetched ahead of each seek, or http to read an INPUT URL\n"
+                    "                  through concurrent range requests of the next GOPs and a block cache\n"
+                    "  -j 1..256       number of parallel demuxing and decoding workers\n"
+                    "  -J 1..256       number of concurrent jobs with -B, one per CPU core by default\n"
+                    "  -k              extract the nearest keyframe at or before each time, decoding only keyframes\n"
                     "  -l -1.0..1.0    quadratic lens correction coefficient\n"
+                    "  -L, --listen SOCKET\n"
+                    "                  serve extraction jobs on a Unix domain socket, one request per line:\n"
+                    "                  EXTRACT <us>[,<us>...] <INPUT> streams back FRAME <us> <size> lines, each followed\n"
+                    "                  by the JPEG data, then DONE <frames> or ERROR <message>;\n"
+                    "                  STATS answers STATS <cache hits> <misses> <evictions> <open sources>\n"
+                    "  -m MIB          keep up to MIB MiB of decoded frames per input for requests in the same GOPs\n"
+                    "  -M, --huge-pages\n"
+                    "                  back the pooled buffers of large decoded frames with transparent huge pages\n"
+                    "  -P SECONDS      print the progress at most every SECONDS seconds\n"
                     "  -q 1..100       output quality\n"
+                    "  -R FILE         write a JSON report of the time spent seeking, demuxing, decoding, filtering,\n"
+                    "                  encoding and muxing, and of the frames and bytes processed, to FILE (or -)\n"
+                    "                  at exit\n"
                     "  -s BYTES        output file size limit\n"
+                    "  -t, --tolerance MS\n"
+                    "                  accept the first frame within MS milliseconds of each time\n"
+                    "  -S 0..2         skip decoding ahead of each target: 1 non-reference frames (exact output),\n"
+                    "                  2 also the loop filter of reference frames (faster, slightly degraded)\n"
+                    "  -v              print pipeline statistics at exit\n"
+                    "  -W PIXELS       output width, following the aspect ratio of the input without -H; the input is\n"
+                    "                  decoded at a reduced resolution when its decoder supports it, then downscaled\n"
+                    "  -x FILE         keyframe index of the input, built on first use and reused later\n"
+                    "  -y, --sync      with -b, flush every output file to the disk with fdatasync before closing it\n"
+                    "\n"
+                    "TIMES may be - to read from stdin. Text and binary times are streamed: frames are extracted\n"
+                    "while more times are still arriving.\n"
+                    "\n"
+                    "Besides {\"time\": ...} entries, JSON times may hold ranges:\n"
+                    "  {\"from\": ..., \"to\": ..., \"every\": ...}  a frame every given interval\n"
+                    "  {\"from\": ..., \"to\": ..., \"frames\": N}   every Nth frame\n"
+                    "Each range is decoded forward from its start, without seeking inside it.\n"
                     "\n"
                     "If the size limit is set, the OUTPUT argument should contain a %%d format specifier. Example:\n"
                     "  %s -s 500000000 input.avi example.json output_%%d.avi\n",
-            self, self);
+            self, self, self, self);
 }
 
 static void stop(int sig) {
     stop_signal = sig;
+    if (extractor != NULL)
+        extractor_stop(extractor);
 }
 
 
 int main(int argc, char **argv) {
     int ret = 0, success = 0;
-    int video_frame_count = 0;
+    struct extractor_options options;
+    struct timestamps input;
+    int64_t *times = NULL;
+    uint8_t *sequential = NULL;
+    unsigned int times_capacity = 0;
+
+    extractor_default_options(&options);
+    options.packet_cb = write_packet;
 
     signal(SIGTERM, stop);
     signal(SIGINT, stop);
 
+    static const struct option long_options[] = {
+            {"help",       no_argument,       NULL, 'h'},
+            {"sync",       no_argument,       NULL, 'y'},
+            {"huge-pages", no_argument,       NULL, 'M'},
+            {"listen",     required_argument, NULL, 'L'},
+            {"batch",      required_argument, NULL, 'B'},
+            {"format",     required_argument, NULL, 'F'},
+            {"tolerance",  required_argument, NULL, 't'},
+            {NULL, 0,                         NULL, 0}
+    };
     int opt;
-    while ((opt = getopt(argc, argv, "hf:l:q:s:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "hb:B:C:d:D:e:f:F:H:I:j:J:kl:L:m:MP:q:R:s:S:t:vW:x:y", long_options,
+                              NULL)) != -1) {
         unsigned long ulong_value = 0;
         double double_value = 0.0;
         if (opt == 'l')
@@ -314,6 +315,49 @@ int main(int argc, char **argv) {
             case 'h':
                 print_usage(argv[0]);
                 exit(0);
+            case 'b':
+                if (ulong_value < 1 || ulong_value > WRITE_BUFFER_MAX) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                write_buffer_size = (size_t) ulong_value << 20;
+                break;
+            case 'B':
+                manifest_filename = optarg;
+                break;
+            case 'C':
+                if (ulong_value < 1 || ulong_value > CACHE_SIZE_MAX) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                cache_size = (unsigned int) ulong_value;
+                break;
+            case 'd':
+                if (ulong_value > THREADS_MAX) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                options.decoder_threads = (unsigned int) ulong_value;
+                break;
+            case 'D':
+                if (strcmp(optarg, "frame") == 0)
+                    options.decoder_thread_type = FF_THREAD_FRAME;
+                else if (strcmp(optarg, "slice") == 0)
+                    options.decoder_thread_type = FF_THREAD_SLICE;
+                else if (strcmp(optarg, "auto") == 0)
+                    options.decoder_thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+                else {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'e':
+                if (ulong_value > THREADS_MAX) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                options.encoder_threads = (unsigned int) ulong_value;
+                break;
             case 'f':
                 if (ulong_value < 1 || ulong_value > 60) {
                     print_usage(argv[0]);
@@ -321,20 +365,79 @@ int main(int argc, char **argv) {
                 }
                 framerate = (unsigned int) ulong_value;
                 break;
+            case 'F':
+                if (timestamps_parse_format(optarg, &times_format) < 0) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'H':
+                if (ulong_value < 1 || ulong_value > DIMENSION_MAX) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                options.height = (int) ulong_value;
+                break;
+            case 'I':
+                if (input_parse_mode(optarg, &options.input_mode) < 0) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'j':
+                if (ulong_value < 1 || ulong_value > JOBS_MAX) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                options.jobs = (unsigned int) ulong_value;
+                break;
+            case 'J':
+                if (ulong_value < 1 || ulong_value > BATCH_WORKERS_MAX) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                batch_workers = (unsigned int) ulong_value;
+                break;
+            case 'k':
+                options.keyframes_only = 1;
+                break;
             case 'l':
                 if (double_value < -1.0 || double_value > 1.0) {
                     print_usage(argv[0]);
                     exit(1);
                 }
-                enable_lenscorrection = 1;
-                lenscorrection_k1 = double_value;
+                options.lenscorrection = 1;
+                options.lenscorrection_k1 = double_value;
+                break;
+            case 'L':
+                socket_filename = optarg;
+                break;
+            case 'm':
+                if (ulong_value < 1 || ulong_value > FRAME_CACHE_MAX) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                options.frame_cache_size = (size_t) ulong_value << 20;
+                break;
+            case 'M':
+                options.huge_pages = 1;
+                break;
+            case 'P':
+                if (ulong_value < 1 || ulong_value > PROGRESS_INTERVAL_MAX) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                progress_interval = (unsigned int) ulong_value;
                 break;
             case 'q':
                 if (ulong_value < 1 || ulong_value > 100) {
                     print_usage(argv[0]);
                     exit(1);
                 }
-                quality = (unsigned int) ulong_value;
+                options.quality = (unsigned int) ulong_value;
+                break;
+            case 'R':
+                report_filename = optarg;
                 break;
             case 's':
                 if (ulong_value < 1) {
@@ -343,19 +446,53 @@ int main(int argc, char **argv) {
                 }
                 size_limit = ulong_value;
                 break;
+            case 'S':
+                if (ulong_value > 2) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                options.skip_mode = (int) ulong_value;
+                break;
+            case 't':
+                if (ulong_value < 1 || ulong_value > 3600000) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                options.tolerance_ms = ulong_value;
+                break;
+            case 'v':
+                options.verbose = 1;
+                break;
+            case 'W':
+                if (ulong_value < 1 || ulong_value > DIMENSION_MAX) {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                options.width = (int) ulong_value;
+                break;
+            case 'x':
+                options.index_filename = optarg;
+                break;
+            case 'y':
+                write_sync = 1;
+                break;
             default:
                 break;
         }
     }
-    if (argc - optind != 3) {
+    if (argc - optind != (socket_filename != NULL || manifest_filename != NULL ? 0 : 3) ||
+        (socket_filename != NULL && manifest_filename != NULL)) {
         print_usage(argv[0]);
         exit(1);
     }
-    src_filename = argv[optind];
-    json_filename = argv[optind + 1];
-    dst_filename = argv[optind + 2];
+    if (socket_filename == NULL && manifest_filename == NULL) {
+        src_filename = argv[optind];
+        times_filename = argv[optind + 1];
+        dst_filename = argv[optind + 2];
+    }
 
-    if (size_limit > 0 && strstr(dst_filename, "%d") == NULL) {
+    if ((size_limit > 0 && dst_filename != NULL && strstr(dst_filename, "%d") == NULL) ||
+        (write_sync && write_buffer_size == 0)) {
         print_usage(argv[0]);
         exit(1);
     }
@@ -363,118 +500,75 @@ int main(int argc, char **argv) {
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 9, 100)
     av_register_all();
 #endif
-    if (enable_lenscorrection)
-        avfilter_register_all();
 
-    if ((ret = json_parse(json_filename)) < 0) {
-        fprintf(stderr, "Could not parse JSON: %s\n", json_err2str(ret));
-        goto end;
+    if (socket_filename != NULL) {
+        if (options.index_filename != NULL)
+            fprintf(stderr, "Ignoring the index file in server mode\n");
+        options.index_filename = NULL;
+        if (report_filename != NULL)
+            fprintf(stderr, "Ignoring the report file in server mode\n");
+        return server_run(socket_filename, &options, cache_size, &stop_signal) < 0 ? 3 : 0;
     }
 
-    if ((ret = avformat_open_input(&src_fmt_ctx, src_filename, NULL, NULL)) < 0) {
-        fprintf(stderr, "Could not open the source file %s: %s\n", src_filename, av_err2str(ret));
-        goto end;
+    run_start = progress_last = av_gettime_relative();
+    if (report_filename != NULL) {
+        stats_init(&report_stats, 1);
+        options.stats = &report_stats;
     }
-
-    if ((ret = avformat_find_stream_info(src_fmt_ctx, NULL)) < 0) {
-        fprintf(stderr, "Could not find stream information: %s\n", av_err2str(ret));
-        goto end;
+    if (manifest_filename != NULL) {
+        if (options.index_filename != NULL)
+            fprintf(stderr, "Ignoring the index file in batch mode\n");
+        options.index_filename = NULL;
+        if (size_limit > 0 || write_buffer_size > 0 || progress_interval > 0)
+            fprintf(stderr, "Ignoring the size limit, write buffer and progress options in batch mode\n");
+        ret = batch_run(manifest_filename, &options, batch_workers, framerate, times_format, &stop_signal);
+        if (report_filename != NULL && write_report() < 0)
+            ret = -1;
+        return ret < 0 ? 3 : 0;
     }
-
-    if ((ret = open_src(src_fmt_ctx, AVMEDIA_TYPE_VIDEO)) < 0) {
-        fprintf(stderr, "Could not open the source fie: %s\n", av_err2str(ret));
+    if ((ret = timestamps_open(&input, times_filename, times_format)) < 0)
         goto end;
-    }
 
-    if (!src_stream) {
-        fprintf(stderr, "Could not find video stream in the input, aborting\n");
+    if (write_buffer_size > 0 && (ret = writer_init(&writer, write_buffer_size, WRITE_DEPTH, write_sync)) < 0) {
+        fprintf(stderr, "Could not start the output writer: %s\n", av_err2str(ret));
         goto end;
     }
+    if ((ret = extractor_open(&extractor, src_filename, &options)) < 0)
+        goto end;
+    dst_codecpar = extractor_codecpar(extractor);
+    dst_time_base = (AVRational) {1, framerate};
+    timestamps_set_frame_rate(&input, extractor_frame_rate(extractor));
 
-    for (int i = 0; i < json_token_count() && stop_signal == 0; i++) {
-        if (json_token(i).type == JSMN_STRING &&
-            strlen("time") == (unsigned int) (json_token(i).end - json_token(i).start) &&
-            strncmp(json_buffer() + json_token(i).start, "time",
-                    (size_t) (json_token(i).end - json_token(i).start)) == 0) {
-            AVPacket pkt = {0};
-            AVFrame *frame = NULL;
-            AVFrame *prev_frame = NULL;
-            int64_t req_ts = NULL;
-            int done = 0;
-
-            size_t size = (size_t) (json_token(i + 1).end - json_token(i + 1).start);
-            char *time_str = (char *) malloc((size + 1) * sizeof(char));
-            memcpy(time_str, json_buffer() + json_token(i + 1).start, size);
-            time_str[size] = '\0';
-            av_parse_time(&req_ts, time_str, 1);
-            free(time_str);
-            req_ts /= av_q2d(src_stream->time_base) * 1e+6;
-
-            frame = av_frame_alloc();
-            prev_frame = av_frame_alloc();
-            if (!frame || !prev_frame) {
-                fprintf(stderr, "Could not allocate frame\n");
-                goto end;
-            }
-
-            av_seek_frame(src_fmt_ctx, src_video_stream_idx, req_ts, AVSEEK_FLAG_BACKWARD);
-            while (!done && av_read_frame(src_fmt_ctx, &pkt) >= 0) {
-                if (pkt.stream_index != src_video_stream_idx || pkt.dts == AV_NOPTS_VALUE) {
-                    av_packet_unref(&pkt);
-                    continue;
-                }
-                if ((ret = avcodec_send_packet(src_codec_ctx, &pkt)) < 0) {
-                    av_packet_unref(&pkt);
-                    fprintf(stderr, "Error while sending a packet to the decoder: %s\n", av_err2str(ret));
-                    goto end;
-                }
-                while (prev_frame->format < 0) {
-                    av_frame_unref(frame);
-                    avcodec_receive_frame(src_codec_ctx, prev_frame);
-                }
-                while (!done) {
-                    ret = avcodec_receive_frame(src_codec_ctx, frame);
-                    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                        break;
-                    } else if (ret < 0) {
-                        fprintf(stderr, "Error while receiving a frame from the decoder: %s\n", av_err2str(ret));
-                        break;
-                    }
-                    video_frame_count++;
-                    if (llabs(req_ts - frame->best_effort_timestamp) >=
-                        llabs(req_ts - prev_frame->best_effort_timestamp)) {
-                        if (write_frame(prev_frame) != 0) {
-                            av_frame_unref(frame);
-                            av_frame_unref(prev_frame);
-                            av_frame_free(&frame);
-                            av_frame_free(&prev_frame);
-                            goto end;
-                        }
-                        fprintf(stderr, "%ld %.3f %s\n", dst_total_frame_count,
-                                prev_frame->best_effort_timestamp * av_q2d(src_stream->time_base),
-                                dst_current_filename);
-                        done = 1;
-                    } else {
-                        av_frame_unref(prev_frame);
-                        av_frame_copy(prev_frame, frame);
-                    }
-                    av_frame_unref(frame);
-                }
-            }
-            av_frame_unref(prev_frame);
-            av_frame_free(&frame);
-            av_frame_free(&prev_frame);
-        }
+    while (stop_signal == 0 &&
+           (ret = timestamps_read(&input, PLAN_WINDOW, &times, &sequential, &times_capacity)) > 0) {
+        if ((ret = extractor_extract_sequential(extractor, times, sequential, (unsigned int) ret)) != 0)
+            break;
     }
+    if (extractor_close(&extractor) != 0 || ret != 0)
+        goto end;
 
     if (close_dst() != 0)
         goto end;
+    if (write_buffer_size > 0) {
+        if (options.verbose)
+            writer_report(&writer);
+        if ((ret = writer_free(&writer)) < 0) {
+            fprintf(stderr, "Failed to write the output: %s\n", av_err2str(ret));
+            goto end;
+        }
+    }
 
     success = 1;
 
     end:
-    avcodec_free_context(&src_codec_ctx);
-    avformat_close_input(&src_fmt_ctx);
-    json_free();
+    extractor_close(&extractor);
+    close_dst();
+    if (write_buffer_size > 0)
+        writer_free(&writer);
+    timestamps_close(&input);
+    free(times);
+    free(sequential);
+    if (report_filename != NULL && write_report() < 0)
+        success = 0;
     return success > 0 ? 0 : 3;
 }
@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include "plan.h"
+
+static int compare_entries(const void *a, const void *b) {
+    const struct plan_entry *entry_a = a;
+    const struct plan_entry *entry_b = b;
+    if (entry_a->ts != entry_b->ts)
+        return entry_a->ts < entry_b->ts ? -1 : 1;
+    if (entry_a->index != entry_b->index)
+        return entry_a->index < entry_b->index ? -1 : 1;
+    return 0;
+}
+
+void plan_init(struct plan *plan) {
+    plan->entries = NULL;
+    plan->count = 0;
+    plan->capacity = 0;
+}
+
+int plan_add(struct plan *plan, int64_t ts, int sequential) {
+    if (plan->count == plan->capacity) {
+        unsigned int capacity = plan->capacity > 0 ? plan->capacity * 2 : 64;
+        struct plan_entry *entries = realloc(plan->entries, capacity * sizeof(struct plan_entry));
+        if (entries == NULL)
+            return -1;
+        plan->entries = entries;
+        plan->capacity = capacity;
+    }
+    plan->entries[plan->count].ts = ts;
+    plan->entries[plan->count].index = plan->count;
+    plan->entries[plan->count].sequential = sequential;
+    plan->count++;
+    return 0;
+}
+
+/*
+ * Drops the requests but keeps the storage for the next window.
+ */
+void plan_clear(struct plan *plan) {
+    plan->count = 0;
+}
+
+/*
+ * Orders the requests by timestamp so the source can be decoded in a single forward pass.
+ * The original position of every request is kept in entry.index.
+ */
+void plan_sort(struct plan *plan) {
+    if (plan->count > 1)
+        qsort(plan->entries, plan->count, sizeof(struct plan_entry), compare_entries);
+}
+
+void plan_free(struct plan *plan) {
+    if (plan->entries != NULL)
+        free(plan->entries);
+    plan_init(plan);
+}
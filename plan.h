@@ -0,0 +1,28 @@
+#ifndef FRAME_EXTRACTOR_PLAN_H
+#define FRAME_EXTRACTOR_PLAN_H
+
+#include <stdint.h>
+
+/*
+ * A sequential entry belongs to a range and follows its previous time there, so it is reached by decoding
+ * forward from it, never by seeking.
+ */
+struct plan_entry {
+    int64_t ts;
+    unsigned int index;
+    int sequential;
+};
+
+struct plan {
+    struct plan_entry *entries;
+    unsigned int count;
+    unsigned int capacity;
+};
+
+void plan_init(struct plan *plan);
+int plan_add(struct plan *plan, int64_t ts, int sequential);
+void plan_clear(struct plan *plan);
+void plan_sort(struct plan *plan);
+void plan_free(struct plan *plan);
+
+#endif //FRAME_EXTRACTOR_PLAN_H
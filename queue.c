@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <libavutil/avutil.h>
+#include <libavutil/time.h>
+#include "queue.h"
+
+int queue_init(struct queue *q, const char *name, unsigned int capacity, void (*free_item)(void *item)) {
+    q->name = name;
+    q->items = malloc(capacity * sizeof(void *));
+    if (q->items == NULL)
+        return AVERROR(ENOMEM);
+    q->capacity = capacity;
+    q->head = 0;
+    q->count = 0;
+    q->closed = 0;
+    q->aborted = 0;
+    q->free_item = free_item;
+    q->pushed = 0;
+    q->depth_sum = 0;
+    q->max_depth = 0;
+    q->producer_stall = 0;
+    q->consumer_stall = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    return 0;
+}
+
+/*
+ * Blocks while the queue is full. Takes ownership of the item, which is freed if the consumer is gone.
+ */
+int queue_push(struct queue *q, void *item) {
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->capacity && !q->aborted) {
+        int64_t start = av_gettime_relative();
+        while (q->count == q->capacity && !q->aborted)
+            pthread_cond_wait(&q->not_full, &q->lock);
+        q->producer_stall += av_gettime_relative() - start;
+    }
+    if (q->aborted || q->closed) {
+        pthread_mutex_unlock(&q->lock);
+        q->free_item(item);
+        return AVERROR_EXIT;
+    }
+    q->items[(q->head + q->count) % q->capacity] = item;
+    q->count++;
+    q->pushed++;
+    q->depth_sum += q->count;
+    if (q->count > q->max_depth)
+        q->max_depth = q->count;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+/*
+ * Blocks while the queue is empty. Returns NULL once the queue is closed and drained, or aborted.
+ */
+void *queue_pop(struct queue *q) {
+    void *item = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->count == 0 && !q->closed && !q->aborted) {
+        int64_t start = av_gettime_relative();
+        while (q->count == 0 && !q->closed && !q->aborted)
+            pthread_cond_wait(&q->not_empty, &q->lock);
+        q->consumer_stall += av_gettime_relative() - start;
+    }
+    if (q->count > 0 && !q->aborted) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+void queue_close(struct queue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void queue_abort(struct queue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->aborted = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void queue_report(struct queue *q) {
+    pthread_mutex_lock(&q->lock);
+    fprintf(stderr, "%s queue: %lu items, average depth %.2f, max depth %u/%u, "
+                    "producer stalled %.3f s, consumer stalled %.3f s\n",
+            q->name, (unsigned long) q->pushed, q->pushed > 0 ? (double) q->depth_sum / q->pushed : 0.0,
+            q->max_depth, q->capacity, q->producer_stall / 1e+6, q->consumer_stall / 1e+6);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void queue_free(struct queue *q) {
+    if (q->items == NULL)
+        return;
+    while (q->count > 0) {
+        q->free_item(q->items[q->head]);
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+    }
+    free(q->items);
+    q->items = NULL;
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
@@ -0,0 +1,34 @@
+#ifndef FRAME_EXTRACTOR_QUEUE_H
+#define FRAME_EXTRACTOR_QUEUE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+struct queue {
+    const char *name;
+    void **items;
+    unsigned int capacity;
+    unsigned int head;
+    unsigned int count;
+    int closed;
+    int aborted;
+    void (*free_item)(void *item);
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint64_t pushed;
+    uint64_t depth_sum;
+    unsigned int max_depth;
+    int64_t producer_stall;
+    int64_t consumer_stall;
+};
+
+int queue_init(struct queue *q, const char *name, unsigned int capacity, void (*free_item)(void *item));
+int queue_push(struct queue *q, void *item);
+void *queue_pop(struct queue *q);
+void queue_close(struct queue *q);
+void queue_abort(struct queue *q);
+void queue_report(struct queue *q);
+void queue_free(struct queue *q);
+
+#endif //FRAME_EXTRACTOR_QUEUE_H
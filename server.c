@@ -0,0 +1,508 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/error.h>
+#include "server.h"
+
+#ifndef _WIN32
+
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define REQUEST_MAX 65536
+#define POLL_INTERVAL 500
+
+/*
+ * An opened source, with its demuxer, decoder and encoder. The entry lock is held while a job runs on it.
+ * An entry is listed as soon as its source starts opening, so that concurrent jobs on the same path wait for it
+ * instead of opening the source again. error is the result of the opening.
+ */
+struct source_entry {
+    char *path;
+    int64_t size;
+    int64_t mtime;
+    struct extractor *ex;
+    unsigned int refs;
+    int opening;
+    int error;
+    int broken;
+    pthread_mutex_t lock;
+    struct source_entry *prev;
+    struct source_entry *next;
+};
+
+/*
+ * The cache keeps the entries in a list from the most to the least recently used.
+ */
+struct server {
+    struct extractor_options options;
+    unsigned int cache_size;
+    volatile int *stop;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    pthread_cond_t opened;
+    struct source_entry *head;
+    struct source_entry *tail;
+    unsigned int count;
+    unsigned int connections;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+struct connection {
+    struct server *server;
+    int fd;
+    int broken;
+    unsigned int frames;
+    int64_t *times;
+    unsigned int times_capacity;
+    size_t start;
+    size_t length;
+    char buffer[REQUEST_MAX];
+};
+
+static void unlink_entry(struct server *server, struct source_entry *entry) {
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        server->head = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        server->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void push_entry(struct server *server, struct source_entry *entry) {
+    entry->next = server->head;
+    entry->prev = NULL;
+    if (server->head != NULL)
+        server->head->prev = entry;
+    else
+        server->tail = entry;
+    server->head = entry;
+}
+
+static void free_entry(struct source_entry *entry) {
+    extractor_close(&entry->ex);
+    pthread_mutex_destroy(&entry->lock);
+    free(entry->path);
+    free(entry);
+}
+
+/*
+ * Unlinks the unused entries that are broken or beyond the cache size, least recently used first.
+ * Returns them as a list for the caller to free outside of the server lock.
+ */
+static struct source_entry *evict(struct server *server) {
+    struct source_entry *evicted = NULL, *entry = server->tail;
+    while (entry != NULL) {
+        struct source_entry *prev = entry->prev;
+        if (entry->refs == 0 && (entry->broken || server->count > server->cache_size)) {
+            unlink_entry(server, entry);
+            server->count--;
+            server->evictions += !entry->broken;
+            entry->next = evicted;
+            evicted = entry;
+        }
+        entry = prev;
+    }
+    return evicted;
+}
+
+static void free_entries(struct source_entry *entry) {
+    while (entry != NULL) {
+        struct source_entry *next = entry->next;
+        free_entry(entry);
+        entry = next;
+    }
+}
+
+static void release(struct server *server, struct source_entry *entry, int broken) {
+    pthread_mutex_lock(&server->lock);
+    entry->refs--;
+    if (broken)
+        entry->broken = 1;
+    struct source_entry *evicted = evict(server);
+    pthread_mutex_unlock(&server->lock);
+    free_entries(evicted);
+}
+
+/*
+ * Finds the opened source for path, or opens it. Local sources changed on disk since they were opened are
+ * reopened, URLs are kept as they are. A source being opened by another job is waited for, and its opening
+ * error is shared.
+ */
+static int acquire(struct server *server, const char *path, struct source_entry **result) {
+    int ret, local = server->options.input_mode != INPUT_HTTP;
+    struct stat st;
+    struct source_entry *entry;
+
+    if (local && stat(path, &st) < 0) {
+        if (strstr(path, "://") == NULL)
+            return AVERROR(errno);
+        local = 0;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    for (entry = server->head; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->path, path) != 0 || entry->broken)
+            continue;
+        if (local && (entry->size != (int64_t) st.st_size || entry->mtime != (int64_t) st.st_mtime)) {
+            entry->broken = 1;
+            continue;
+        }
+        entry->refs++;
+        while (entry->opening)
+            pthread_cond_wait(&server->opened, &server->lock);
+        if (entry->error < 0) {
+            ret = entry->error;
+            pthread_mutex_unlock(&server->lock);
+            release(server, entry, 1);
+            return ret;
+        }
+        unlink_entry(server, entry);
+        push_entry(server, entry);
+        server->hits++;
+        pthread_mutex_unlock(&server->lock);
+        *result = entry;
+        return 0;
+    }
+    server->misses++;
+
+    if ((entry = calloc(1, sizeof(struct source_entry))) == NULL) {
+        pthread_mutex_unlock(&server->lock);
+        return AVERROR(ENOMEM);
+    }
+    if ((entry->path = strdup(path)) == NULL) {
+        pthread_mutex_unlock(&server->lock);
+        free(entry);
+        return AVERROR(ENOMEM);
+    }
+    entry->size = local ? (int64_t) st.st_size : -1;
+    entry->mtime = local ? (int64_t) st.st_mtime : -1;
+    entry->refs = 1;
+    entry->opening = 1;
+    pthread_mutex_init(&entry->lock, NULL);
+    push_entry(server, entry);
+    server->count++;
+    struct source_entry *evicted = evict(server);
+    pthread_mutex_unlock(&server->lock);
+    free_entries(evicted);
+
+    ret = extractor_open(&entry->ex, entry->path, &server->options);
+
+    pthread_mutex_lock(&server->lock);
+    entry->opening = 0;
+    entry->error = ret < 0 ? ret : 0;
+    pthread_cond_broadcast(&server->opened);
+    pthread_mutex_unlock(&server->lock);
+    if (ret < 0) {
+        release(server, entry, 1);
+        return ret;
+    }
+    *result = entry;
+    return 0;
+}
+
+static int send_all(int fd, const void *data, size_t size) {
+    const char *cursor = data;
+    while (size > 0) {
+        ssize_t sent = send(fd, cursor, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return AVERROR(errno);
+        cursor += sent;
+        size -= (size_t) sent;
+    }
+    return 0;
+}
+
+static void send_line(struct connection *conn, const char *line) {
+    if (!conn->broken && send_all(conn->fd, line, strlen(line)) < 0)
+        conn->broken = 1;
+}
+
+/*
+ * Streams a frame to the client as "FRAME <time in us> <size>\n" followed by the JPEG data. A client that went
+ * away only stops the sending, so that the source stays usable for the next jobs.
+ */
+static int send_frame(void *opaque, AVPacket *packet) {
+    struct connection *conn = opaque;
+    char header[64];
+    int length = snprintf(header, sizeof(header), "FRAME %" PRId64 " %d\n", packet->pts, packet->size);
+
+    if (!conn->broken && (send_all(conn->fd, header, (size_t) length) < 0 ||
+                          send_all(conn->fd, packet->data, (size_t) packet->size) < 0))
+        conn->broken = 1;
+    conn->frames++;
+    return 0;
+}
+
+/*
+ * Parses "<time>[,<time>...] <path>" into the connection's times and returns the path, or NULL if invalid.
+ */
+static const char *parse_job(struct connection *conn, char *args, unsigned int *count) {
+    char *cursor = args;
+    *count = 0;
+    for (;;) {
+        char *end;
+        errno = 0;
+        long long value = strtoll(cursor, &end, 10);
+        if (end == cursor || errno != 0 || (*end != ',' && *end != ' '))
+            return NULL;
+        if (*count == conn->times_capacity) {
+            unsigned int capacity = conn->times_capacity > 0 ? conn->times_capacity * 2 : 64;
+            int64_t *times = realloc(conn->times, capacity * sizeof(int64_t));
+            if (times == NULL)
+                return NULL;
+            conn->times = times;
+            conn->times_capacity = capacity;
+        }
+        conn->times[(*count)++] = value;
+        cursor = end + 1;
+        if (*end == ' ')
+            return *cursor != '\0' ? cursor : NULL;
+    }
+}
+
+static int run_job(struct connection *conn, const char *path, unsigned int count) {
+    int ret;
+    struct source_entry *entry;
+
+    if ((ret = acquire(conn->server, path, &entry)) < 0)
+        return ret;
+    pthread_mutex_lock(&entry->lock);
+    conn->frames = 0;
+    extractor_set_output(entry->ex, send_frame, conn);
+    if (*conn->server->stop)
+        ret = AVERROR_EXIT;
+    else if ((ret = extractor_extract(entry->ex, conn->times, count)) == 0)
+        ret = extractor_flush(entry->ex);
+    pthread_mutex_unlock(&entry->lock);
+    release(conn->server, entry, ret < 0);
+    return ret;
+}
+
+/*
+ * Handles one request line:
+ *   EXTRACT <time>[,<time>...] <path>  streams the frames, then answers DONE <frames> or ERROR <message>
+ *   STATS                              answers STATS <hits> <misses> <evictions> <open sources>
+ */
+static void handle_request(struct connection *conn, char *line) {
+    char reply[128];
+    struct server *server = conn->server;
+
+    if (strcmp(line, "STATS") == 0) {
+        pthread_mutex_lock(&server->lock);
+        snprintf(reply, sizeof(reply), "STATS %" PRIu64 " %" PRIu64 " %" PRIu64 " %u\n", server->hits,
+                 server->misses, server->evictions, server->count);
+        pthread_mutex_unlock(&server->lock);
+    } else if (strncmp(line, "EXTRACT ", 8) == 0) {
+        unsigned int count;
+        const char *path = parse_job(conn, line + 8, &count);
+        int ret = path != NULL ? run_job(conn, path, count) : AVERROR(EINVAL);
+        if (ret < 0)
+            snprintf(reply, sizeof(reply), "ERROR %s\n", av_err2str(ret));
+        else
+            snprintf(reply, sizeof(reply), "DONE %u\n", conn->frames);
+    } else {
+        snprintf(reply, sizeof(reply), "ERROR %s\n", av_err2str(AVERROR(ENOSYS)));
+    }
+    send_line(conn, reply);
+}
+
+/*
+ * Returns the next request line without its newline, or NULL when the client is gone or the server stops.
+ */
+static char *read_line(struct connection *conn) {
+    for (;;) {
+        char *newline = memchr(conn->buffer + conn->start, '\n', conn->length - conn->start);
+        if (newline != NULL) {
+            char *line = conn->buffer + conn->start;
+            *newline = '\0';
+            if (newline > line && newline[-1] == '\r')
+                newline[-1] = '\0';
+            conn->start = (size_t) (newline - conn->buffer) + 1;
+            return line;
+        }
+        if (conn->start > 0) {
+            memmove(conn->buffer, conn->buffer + conn->start, conn->length - conn->start);
+            conn->length -= conn->start;
+            conn->start = 0;
+        }
+        if (conn->length == sizeof(conn->buffer))
+            return NULL;
+
+        struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, POLL_INTERVAL);
+        if (*conn->server->stop)
+            return NULL;
+        if (ready <= 0)
+            continue;
+        ssize_t size = recv(conn->fd, conn->buffer + conn->length, sizeof(conn->buffer) - conn->length, 0);
+        if (size < 0 && errno == EINTR)
+            continue;
+        if (size <= 0)
+            return NULL;
+        conn->length += (size_t) size;
+    }
+}
+
+static void *connection_main(void *arg) {
+    char *line;
+    struct connection *conn = arg;
+    struct server *server = conn->server;
+
+    while (!conn->broken && (line = read_line(conn)) != NULL)
+        handle_request(conn, line);
+
+    close(conn->fd);
+    free(conn->times);
+    free(conn);
+    pthread_mutex_lock(&server->lock);
+    server->connections--;
+    pthread_cond_broadcast(&server->idle);
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+static int open_socket(const char *socket_path) {
+    int fd;
+    struct sockaddr_un addr;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return AVERROR(ENAMETOOLONG);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return AVERROR(errno);
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        int ret = AVERROR(errno);
+        close(fd);
+        return ret;
+    }
+    return fd;
+}
+
+/*
+ * Makes the running jobs give up at their next frame, so that stopping the server does not wait for the end
+ * of long extractions. Jobs that start later see *stop and do not run.
+ */
+static void stop_jobs(struct server *server) {
+    pthread_mutex_lock(&server->lock);
+    for (struct source_entry *entry = server->head; entry != NULL; entry = entry->next) {
+        if (!entry->opening && entry->ex != NULL)
+            extractor_stop(entry->ex);
+    }
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void accept_connection(struct server *server, int listen_fd) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    struct connection *conn;
+    int fd = accept(listen_fd, NULL, NULL);
+
+    if (fd < 0)
+        return;
+    if ((conn = calloc(1, sizeof(struct connection))) == NULL) {
+        close(fd);
+        return;
+    }
+    conn->server = server;
+    conn->fd = fd;
+    pthread_mutex_lock(&server->lock);
+    server->connections++;
+    pthread_mutex_unlock(&server->lock);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, connection_main, conn) != 0) {
+        fprintf(stderr, "Could not start a connection thread\n");
+        close(fd);
+        free(conn);
+        pthread_mutex_lock(&server->lock);
+        server->connections--;
+        pthread_mutex_unlock(&server->lock);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * Serves extraction jobs on a Unix domain socket until *stop is set, one thread per client.
+ * The opened sources are kept in an LRU cache of cache_size entries, keyed by path.
+ */
+int server_run(const char *socket_path, const struct extractor_options *options, unsigned int cache_size,
+               volatile int *stop) {
+    int listen_fd;
+    struct server server;
+
+    memset(&server, 0, sizeof(server));
+    server.options = *options;
+    server.options.packet_cb = send_frame;
+    server.cache_size = cache_size;
+    server.stop = stop;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.idle, NULL);
+    pthread_cond_init(&server.opened, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((listen_fd = open_socket(socket_path)) < 0) {
+        fprintf(stderr, "Could not listen on %s: %s\n", socket_path, av_err2str(listen_fd));
+        return listen_fd;
+    }
+    if (options->verbose)
+        fprintf(stderr, "Listening on %s\n", socket_path);
+
+    while (!*stop) {
+        struct pollfd pfd = {.fd = listen_fd, .events = POLLIN};
+        if (poll(&pfd, 1, POLL_INTERVAL) > 0)
+            accept_connection(&server, listen_fd);
+    }
+    close(listen_fd);
+    unlink(socket_path);
+    stop_jobs(&server);
+
+    pthread_mutex_lock(&server.lock);
+    while (server.connections > 0)
+        pthread_cond_wait(&server.idle, &server.lock);
+    pthread_mutex_unlock(&server.lock);
+
+    fprintf(stderr, "Source cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions\n",
+            server.hits, server.misses, server.evictions);
+    free_entries(server.head);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.idle);
+    pthread_cond_destroy(&server.opened);
+    return 0;
+}
+
+#else
+
+int server_run(const char *socket_path, const struct extractor_options *options, unsigned int cache_size,
+               volatile int *stop) {
+    (void) socket_path;
+    (void) options;
+    (void) cache_size;
+    (void) stop;
+    fprintf(stderr, "Server mode is not supported on this platform\n");
+    return AVERROR(ENOSYS);
+}
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef FRAME_EXTRACTOR_SERVER_H
+#define FRAME_EXTRACTOR_SERVER_H
+
+#include "extractor.h"
+
+int server_run(const char *socket_path, const struct extractor_options *options, unsigned int cache_size,
+               volatile int *stop);
+
+#endif //FRAME_EXTRACTOR_SERVER_H
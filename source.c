@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include "source.h"
+
+#define SEEK_THRESHOLD_DEFAULT 10
+#define DECODE_RETRIES_MAX 8
+
+/*
+ * The largest lowres factor that the decoder supports and that still decodes at least width x height.
+ * A zero side is not constrained.
+ */
+static int choose_lowres(const AVCodec *dec, const AVCodecParameters *par, int width, int height) {
+    int lowres = 0;
+    if (width <= 0 && height <= 0)
+        return 0;
+    while (lowres < dec->max_lowres && (par->width >> (lowres + 1)) >= width &&
+           (par->height >> (lowres + 1)) >= height)
+        lowres++;
+    return lowres;
+}
+
+static int open_decoder(struct source *src, const char *filename, enum AVMediaType type, int width, int height,
+                        int thread_count, int thread_type) {
+    int ret;
+    AVCodec *dec = NULL;
+    AVDictionary *opts = NULL;
+
+    ret = av_find_best_stream(src->fmt_ctx, type, -1, -1, &dec, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Could not find %s stream in input file '%s'\n",
+                av_get_media_type_string(type), filename);
+        return ret;
+    } else {
+        AVStream *st;
+        int stream_idx = ret;
+        st = src->fmt_ctx->streams[stream_idx];
+
+        src->codec_ctx = avcodec_alloc_context3(dec);
+        if (!src->codec_ctx) {
+            fprintf(stderr, "Failed to allocate codec\n");
+            return AVERROR(EINVAL);
+        }
+
+        ret = avcodec_parameters_to_context(src->codec_ctx, st->codecpar);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to copy codec parameters to codec context\n");
+            return ret;
+        }
+
+        src->codec_ctx->lowres = choose_lowres(dec, st->codecpar, width, height);
+        src->codec_ctx->thread_count = thread_count;
+        src->codec_ctx->thread_type = thread_type;
+        frame_pool_attach(&src->frame_pool, src->codec_ctx);
+        if ((ret = avcodec_open2(src->codec_ctx, dec, &opts)) < 0) {
+            fprintf(stderr, "Failed to open %s codec\n",
+                    av_get_media_type_string(type));
+            return ret;
+        }
+
+        src->video_stream_idx = stream_idx;
+        src->stream = src->fmt_ctx->streams[src->video_stream_idx];
+    }
+
+    return 0;
+}
+
+static const AVIndexEntry *stream_index_entry(AVStream *stream, int idx) {
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+    return idx < avformat_index_get_entries_count(stream) ? avformat_index_get_entry(stream, idx) : NULL;
+#else
+    return idx < stream->nb_index_entries ? &stream->index_entries[idx] : NULL;
+#endif
+}
+
+int64_t source_keyframe_before(const struct source *src, int64_t ts) {
+    if (src->index != NULL && src->index->keyframe_count > 0) {
+        const struct index_entry *keyframe = index_keyframe_before(src->index, ts);
+        return keyframe != NULL ? keyframe->pts : AV_NOPTS_VALUE;
+    }
+    int idx = av_index_search_timestamp(src->stream, ts, AVSEEK_FLAG_BACKWARD);
+    if (idx < 0)
+        return AV_NOPTS_VALUE;
+    return stream_index_entry(src->stream, idx)->timestamp;
+}
+
+/*
+ * Finds the byte range of the GOP holding ts, from its keyframe up to the next one, or -1 as the end if unknown.
+ */
+static int gop_range(const struct source *src, int64_t ts, int64_t *begin, int64_t *end) {
+    if (src->index != NULL && src->index->keyframe_count > 0) {
+        const struct index_entry *keyframe = index_keyframe_before(src->index, ts);
+        const struct index_entry *next = index_keyframe_after(src->index, ts);
+        if (keyframe == NULL)
+            return AVERROR(ENOENT);
+        *begin = keyframe->pos;
+        *end = next != NULL ? next->pos : -1;
+        return 0;
+    }
+    int idx = av_index_search_timestamp(src->stream, ts, AVSEEK_FLAG_BACKWARD);
+    const AVIndexEntry *entry;
+    if (idx < 0)
+        return AVERROR(ENOENT);
+    *begin = stream_index_entry(src->stream, idx)->pos;
+    *end = -1;
+    while ((entry = stream_index_entry(src->stream, ++idx)) != NULL) {
+        if (entry->flags & AVINDEX_KEYFRAME) {
+            *end = entry->pos;
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Packets well before the target can only produce frames that are thrown away, so the decoder may skip the
+ * non-reference ones. The margin keeps full decoding for the last few frames, which are the nearest-frame
+ * candidates even after B-frame reordering.
+ */
+static void update_discard(struct source *src, const AVPacket *pkt) {
+    if (src->keyframes_only)
+        return;
+    int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    int skip = src->skip_mode > 0 && src->skip_margin > 0 && src->target != AV_NOPTS_VALUE &&
+               ts < src->target - src->skip_margin;
+
+    src->codec_ctx->skip_frame = skip ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    src->codec_ctx->skip_idct = skip ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    if (skip)
+        src->codec_ctx->skip_loop_filter = src->skip_mode > 1 ? AVDISCARD_ALL : AVDISCARD_NONREF;
+    else
+        src->codec_ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+}
+
+void source_init(struct source *src) {
+    src->fmt_ctx = NULL;
+    src->codec_ctx = NULL;
+    src->stream = NULL;
+    src->video_stream_idx = -1;
+    src->index = NULL;
+    src->draining = 0;
+    src->last_keyframe_ts = AV_NOPTS_VALUE;
+    src->keyframe_interval = 0;
+    src->keyframes_only = 0;
+    src->skip_mode = 0;
+    src->skip_margin = 0;
+    src->target = AV_NOPTS_VALUE;
+    input_init(&src->input);
+    stats_init(&src->stats, 0);
+    frame_pool_init(&src->frame_pool, 0);
+}
+
+/*
+ * thread_count and thread_type are passed to the decoder as is; 0 lets libavcodec pick the thread count.
+ * input_mode selects how the file is read, see input.h. A width or height lets decoders that support it
+ * decode at a reduced resolution that is still at least that large. The decoded frames come from a pool of
+ * buffers, backed by huge pages if huge_pages is set.
+ */
+int source_open(struct source *src, const char *filename, enum input_mode input_mode, int width, int height,
+                int huge_pages, int thread_count, int thread_type) {
+    int ret;
+
+    src->frame_pool.huge_pages = huge_pages;
+
+    if ((ret = input_open(&src->input, filename, input_mode)) < 0) {
+        fprintf(stderr, "Could not open the source file %s: %s\n", filename, av_err2str(ret));
+        return ret;
+    }
+    if (src->input.pb != NULL) {
+        if ((src->fmt_ctx = avformat_alloc_context()) == NULL)
+            return AVERROR(ENOMEM);
+        src->fmt_ctx->pb = src->input.pb;
+    }
+    if ((ret = avformat_open_input(&src->fmt_ctx, filename, NULL, NULL)) < 0) {
+        fprintf(stderr, "Could not open the source file %s: %s\n", filename, av_err2str(ret));
+        return ret;
+    }
+
+    if ((ret = avformat_find_stream_info(src->fmt_ctx, NULL)) < 0) {
+        fprintf(stderr, "Could not find stream information: %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    if ((ret = open_decoder(src, filename, AVMEDIA_TYPE_VIDEO, width, height, thread_count, thread_type)) < 0) {
+        fprintf(stderr, "Could not open the source fie: %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    if (!src->stream) {
+        fprintf(stderr, "Could not find video stream in the input, aborting\n");
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+    return 0;
+}
+
+void source_set_keyframes_only(struct source *src, int keyframes_only) {
+    src->keyframes_only = keyframes_only;
+    src->codec_ctx->skip_frame = keyframes_only ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+}
+
+/*
+ * 1 skips non-reference frames before the target, which leaves the output bit-exact.
+ * 2 also skips the loop filter of reference frames, which is faster but slightly degrades the output.
+ */
+void source_set_skip_mode(struct source *src, int skip_mode) {
+    AVRational frame_rate = src->stream->avg_frame_rate.num > 0 ? src->stream->avg_frame_rate
+                                                                : src->stream->r_frame_rate;
+    src->skip_mode = skip_mode;
+    src->skip_margin = 0;
+    if (frame_rate.num > 0 && frame_rate.den > 0)
+        src->skip_margin = (src->codec_ctx->has_b_frames + 2) *
+                           av_rescale_q(1, av_inv_q(frame_rate), src->stream->time_base);
+    if (skip_mode > 0 && src->skip_margin <= 0)
+        fprintf(stderr, "Unknown frame rate, decoding every frame\n");
+}
+
+void source_set_target(struct source *src, int64_t ts) {
+    src->target = ts;
+}
+
+/*
+ * Tells whether no frame following the one at ts can have been skipped by the skip mode, because it lies past
+ * the point where frames are decoded in full. Targets only move forward between seeks.
+ */
+int source_decodes_all_after(const struct source *src, int64_t ts) {
+    return src->skip_mode == 0 || src->skip_margin <= 0 || src->target == AV_NOPTS_VALUE ||
+           ts >= src->target - src->skip_margin;
+}
+
+/*
+ * Returns the next packet of the video stream, keeping track of the keyframe interval.
+ */
+int source_read_packet(struct source *src, AVPacket *pkt) {
+    int ret;
+    int64_t start = stats_start(&src->stats);
+    for (;;) {
+        if ((ret = av_read_frame(src->fmt_ctx, pkt)) < 0) {
+            stats_stop(&src->stats, STATS_DEMUX, start);
+            return ret;
+        }
+        if (pkt->stream_index == src->video_stream_idx && pkt->dts != AV_NOPTS_VALUE)
+            break;
+        av_packet_unref(pkt);
+    }
+    stats_stop(&src->stats, STATS_DEMUX, start);
+    src->stats.packets_demuxed++;
+    src->stats.bytes_demuxed += (uint64_t) pkt->size;
+    if (pkt->flags & AV_PKT_FLAG_KEY) {
+        int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+        if (src->last_keyframe_ts != AV_NOPTS_VALUE && ts - src->last_keyframe_ts > src->keyframe_interval)
+            src->keyframe_interval = ts - src->last_keyframe_ts;
+        src->last_keyframe_ts = ts;
+    }
+    return 0;
+}
+
+/*
+ * Returns the next decoded frame. With frame threading the decoder holds back up to thread_count frames,
+ * so packets are fed until one comes out and the decoder is drained at the end of the input.
+ * A decoding error is retried, as the decoder may still have frames to return, but only DECODE_RETRIES_MAX
+ * times in a row without a packet accepted in between, so that a decoder stuck on an error cannot loop forever.
+ */
+int source_decode_frame(struct source *src, AVFrame *frame) {
+    int ret, errors = 0;
+    int64_t start;
+    AVPacket pkt = {0};
+
+    for (;;) {
+        start = stats_start(&src->stats);
+        ret = avcodec_receive_frame(src->codec_ctx, frame);
+        stats_stop(&src->stats, STATS_DECODE, start);
+        if (ret == 0)
+            src->stats.frames_decoded++;
+        if (ret == 0 || ret == AVERROR_EOF)
+            return ret;
+        if (ret != AVERROR(EAGAIN)) {
+            fprintf(stderr, "Error while receiving a frame from the decoder: %s\n", av_err2str(ret));
+            if (++errors >= DECODE_RETRIES_MAX)
+                return ret;
+            continue;
+        }
+        if (source_read_packet(src, &pkt) < 0) {
+            src->draining = 1;
+            if ((ret = avcodec_send_packet(src->codec_ctx, NULL)) < 0 && ret != AVERROR_EOF) {
+                fprintf(stderr, "Error while draining the decoder: %s\n", av_err2str(ret));
+                return ret;
+            }
+            continue;
+        }
+        if (src->skip_mode > 0)
+            update_discard(src, &pkt);
+        start = stats_start(&src->stats);
+        ret = avcodec_send_packet(src->codec_ctx, &pkt);
+        stats_stop(&src->stats, STATS_DECODE, start);
+        av_packet_unref(&pkt);
+        if (ret < 0) {
+            fprintf(stderr, "Error while sending a packet to the decoder: %s\n", av_err2str(ret));
+            return ret;
+        }
+        errors = 0;
+    }
+}
+
+/*
+ * Intra-only sources in the output codec can be remuxed packet by packet instead of decoded and re-encoded.
+ */
+int source_can_copy(const struct source *src, enum AVCodecID codec_id) {
+    const AVCodecDescriptor *desc = avcodec_descriptor_get(src->stream->codecpar->codec_id);
+    return src->stream->codecpar->codec_id == codec_id && desc != NULL && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+}
+
+int source_seek(struct source *src, int64_t ts) {
+    int ret = -1;
+    int64_t start = stats_start(&src->stats);
+    const struct index_entry *keyframe = src->index != NULL ? index_keyframe_before(src->index, ts) : NULL;
+    if (keyframe != NULL && !(src->fmt_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK))
+        ret = av_seek_frame(src->fmt_ctx, src->video_stream_idx, keyframe->pos, AVSEEK_FLAG_BYTE);
+    if (ret < 0 && (ret = av_seek_frame(src->fmt_ctx, src->video_stream_idx, ts, AVSEEK_FLAG_BACKWARD)) < 0)
+        fprintf(stderr, "Could not seek to %.3f: %s\n", ts * av_q2d(src->stream->time_base), av_err2str(ret));
+    avcodec_flush_buffers(src->codec_ctx);
+    src->draining = 0;
+    src->last_keyframe_ts = AV_NOPTS_VALUE;
+    stats_stop(&src->stats, STATS_SEEK, start);
+    return ret;
+}
+
+/*
+ * Seeking only pays off if it skips decoding: either the index has a keyframe between the last
+ * decoded frame and the target, or the gap is wider than the longest keyframe interval seen so far.
+ */
+int source_should_seek(const struct source *src, int64_t pos, int64_t ts) {
+    if (pos == AV_NOPTS_VALUE)
+        return 1;
+    if (ts <= pos)
+        return 0;
+    int64_t keyframe_ts = source_keyframe_before(src, ts);
+    if (keyframe_ts != AV_NOPTS_VALUE)
+        return keyframe_ts > pos;
+    if (src->keyframe_interval > 0)
+        return ts - pos > src->keyframe_interval;
+    return ts - pos > av_rescale_q(SEEK_THRESHOLD_DEFAULT * AV_TIME_BASE, AV_TIME_BASE_Q, src->stream->time_base);
+}
+
+/*
+ * Starts reading the GOP holding ts ahead of a seek to it, if the input supports prefetching.
+ */
+void source_prefetch(struct source *src, int64_t ts) {
+    int64_t begin, end;
+    if (src->input.pb != NULL && gop_range(src, ts, &begin, &end) == 0)
+        input_prefetch(&src->input, begin, end);
+}
+
+void source_close(struct source *src) {
+    avcodec_free_context(&src->codec_ctx);
+    avformat_close_input(&src->fmt_ctx);
+    input_close(&src->input);
+    frame_pool_uninit(&src->frame_pool);
+    source_init(src);
+}
@@ -0,0 +1,44 @@
+#ifndef FRAME_EXTRACTOR_SOURCE_H
+#define FRAME_EXTRACTOR_SOURCE_H
+
+#include <libavformat/avformat.h>
+#include "frame_pool.h"
+#include "index.h"
+#include "input.h"
+#include "stats.h"
+
+struct source {
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *codec_ctx;
+    AVStream *stream;
+    int video_stream_idx;
+    const struct index *index;
+    int draining;
+    int64_t last_keyframe_ts;
+    int64_t keyframe_interval;
+    int keyframes_only;
+    int skip_mode;
+    int64_t skip_margin;
+    int64_t target;
+    struct input input;
+    struct stats stats;
+    struct frame_pool frame_pool;
+};
+
+void source_init(struct source *src);
+int source_open(struct source *src, const char *filename, enum input_mode input_mode, int width, int height,
+                int huge_pages, int thread_count, int thread_type);
+void source_set_keyframes_only(struct source *src, int keyframes_only);
+void source_set_skip_mode(struct source *src, int skip_mode);
+void source_set_target(struct source *src, int64_t ts);
+int source_decodes_all_after(const struct source *src, int64_t ts);
+int source_read_packet(struct source *src, AVPacket *pkt);
+int source_decode_frame(struct source *src, AVFrame *frame);
+int source_can_copy(const struct source *src, enum AVCodecID codec_id);
+int source_seek(struct source *src, int64_t ts);
+int64_t source_keyframe_before(const struct source *src, int64_t ts);
+int source_should_seek(const struct source *src, int64_t pos, int64_t ts);
+void source_prefetch(struct source *src, int64_t ts);
+void source_close(struct source *src);
+
+#endif //FRAME_EXTRACTOR_SOURCE_H
@@ -0,0 +1,50 @@
+#include <inttypes.h>
+#include <string.h>
+#include <libavutil/error.h>
+#include "stats.h"
+
+static const char *stage_names[STATS_STAGE_COUNT] = {"seek", "demux", "decode", "filter", "encode", "mux"};
+
+void stats_init(struct stats *stats, int enabled) {
+    memset(stats, 0, sizeof(struct stats));
+    stats->enabled = enabled;
+}
+
+void stats_add(struct stats *total, const struct stats *stats) {
+    for (int s = 0; s < STATS_STAGE_COUNT; s++) {
+        total->time[s] += stats->time[s];
+        total->calls[s] += stats->calls[s];
+    }
+    total->frames_decoded += stats->frames_decoded;
+    total->frames_emitted += stats->frames_emitted;
+    total->frames_reused += stats->frames_reused;
+    total->packets_demuxed += stats->packets_demuxed;
+    total->bytes_demuxed += stats->bytes_demuxed;
+    total->bytes_read += stats->bytes_read;
+    total->bytes_written += stats->bytes_written;
+}
+
+/*
+ * Writes the report as one JSON object. seconds is the wall time of the run. Stage times add up over
+ * the threads, so with several workers they may exceed the wall time.
+ */
+int stats_write_json(const struct stats *stats, double seconds, FILE *file) {
+    fprintf(file, "{\n  \"seconds\": %.6f,\n", seconds);
+    fprintf(file, "  \"frames_emitted\": %" PRIu64 ",\n  \"frames_decoded\": %" PRIu64 ",\n",
+            stats->frames_emitted, stats->frames_decoded);
+    fprintf(file, "  \"frames_reused\": %" PRIu64 ",\n", stats->frames_reused);
+    fprintf(file, "  \"decoded_per_emitted\": %.3f,\n",
+            stats->frames_emitted > 0 ? (double) stats->frames_decoded / (double) stats->frames_emitted : 0.0);
+    fprintf(file, "  \"fps\": %.3f,\n", seconds > 0 ? (double) stats->frames_emitted / seconds : 0.0);
+    fprintf(file, "  \"seeks\": %" PRIu64 ",\n  \"packets_demuxed\": %" PRIu64 ",\n",
+            stats->calls[STATS_SEEK], stats->packets_demuxed);
+    fprintf(file, "  \"bytes_read\": %" PRIu64 ",\n  \"bytes_demuxed\": %" PRIu64 ",\n  \"bytes_written\": %" PRIu64
+                  ",\n", stats->bytes_read, stats->bytes_demuxed, stats->bytes_written);
+    fprintf(file, "  \"stages\": {\n");
+    for (int s = 0; s < STATS_STAGE_COUNT; s++) {
+        fprintf(file, "    \"%s\": {\"seconds\": %.6f, \"calls\": %" PRIu64 "}%s\n", stage_names[s],
+                stats->time[s] / 1e+6, stats->calls[s], s + 1 < STATS_STAGE_COUNT ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+    return ferror(file) ? AVERROR(EIO) : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef FRAME_EXTRACTOR_STATS_H
+#define FRAME_EXTRACTOR_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <libavutil/time.h>
+
+enum stats_stage {
+    STATS_SEEK,
+    STATS_DEMUX,
+    STATS_DECODE,
+    STATS_FILTER,
+    STATS_ENCODE,
+    STATS_MUX,
+    STATS_STAGE_COUNT
+};
+
+/*
+ * Time spent in each stage, in microseconds of the monotonic clock, and how often it ran, with counters of
+ * the work done. A stage is only updated by one thread, so that the hot paths take no lock. Nothing is timed
+ * unless enabled, which leaves a single branch per call.
+ */
+struct stats {
+    int enabled;
+    int64_t time[STATS_STAGE_COUNT];
+    uint64_t calls[STATS_STAGE_COUNT];
+    uint64_t frames_decoded;
+    uint64_t frames_emitted;
+    uint64_t frames_reused;
+    uint64_t packets_demuxed;
+    uint64_t bytes_demuxed;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+};
+
+static inline int64_t stats_start(const struct stats *stats) {
+    return stats->enabled ? av_gettime_relative() : 0;
+}
+
+static inline void stats_stop(struct stats *stats, enum stats_stage stage, int64_t start) {
+    if (stats->enabled) {
+        stats->time[stage] += av_gettime_relative() - start;
+        stats->calls[stage]++;
+    }
+}
+
+void stats_init(struct stats *stats, int enabled);
+void stats_add(struct stats *total, const struct stats *stats);
+int stats_write_json(const struct stats *stats, double seconds, FILE *file);
+
+#endif //FRAME_EXTRACTOR_STATS_H
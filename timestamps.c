@@ -0,0 +1,358 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/parseutils.h>
+#include "timestamps.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <poll.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define TIME_STRING_MAX 64
+
+int timestamps_parse_format(const char *name, enum timestamps_format *format) {
+    if (strcmp(name, "json") == 0)
+        *format = TIMESTAMPS_JSON;
+    else if (strcmp(name, "text") == 0)
+        *format = TIMESTAMPS_TEXT;
+    else if (strcmp(name, "binary") == 0)
+        *format = TIMESTAMPS_BINARY;
+    else
+        return AVERROR(EINVAL);
+    return 0;
+}
+
+int timestamps_open(struct timestamps *input, const char *filename, enum timestamps_format format) {
+    int ret;
+    input->format = format;
+    input->fd = -1;
+    input->eof = 0;
+    input->token = 0;
+    input->start = 0;
+    input->end = 0;
+    input->frame_rate = (AVRational) {0, 1};
+    input->in_range = 0;
+
+    if (format == TIMESTAMPS_JSON) {
+        if ((ret = json_parse(&input->json, filename)) < 0) {
+            fprintf(stderr, "Could not parse JSON: %s\n", json_err2str(ret));
+            return AVERROR_INVALIDDATA;
+        }
+        return 0;
+    }
+    if (strcmp(filename, "-") == 0) {
+        input->fd = STDIN_FILENO;
+#ifdef _WIN32
+        _setmode(input->fd, O_BINARY);
+#endif
+    } else if ((input->fd = open(filename, O_RDONLY | O_BINARY)) < 0) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "Could not open %s: %s\n", filename, av_err2str(ret));
+        return ret;
+    }
+    return 0;
+}
+
+/*
+ * Moves the unread bytes to the front of the buffer and reads as much as fits after them, blocking until
+ * at least one byte or the end of the input arrives.
+ */
+static int fill(struct timestamps *input) {
+    ssize_t size;
+    if (input->start > 0) {
+        memmove(input->buffer, input->buffer + input->start, input->end - input->start);
+        input->end -= input->start;
+        input->start = 0;
+    }
+    if (input->end == sizeof(input->buffer))
+        return AVERROR_INVALIDDATA;
+    do {
+        size = read(input->fd, input->buffer + input->end, sizeof(input->buffer) - input->end);
+    } while (size < 0 && errno == EINTR);
+    if (size < 0)
+        return AVERROR(errno);
+    if (size == 0)
+        input->eof = 1;
+    input->end += (size_t) size;
+    return 0;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static int parse_integer(const char *str, size_t size, int64_t *value) {
+    size_t i = 0;
+    int negative = 0;
+    uint64_t result = 0;
+
+    if (size > 0 && (str[0] == '-' || str[0] == '+'))
+        negative = str[i++] == '-';
+    if (i == size)
+        return AVERROR_INVALIDDATA;
+    for (; i < size; i++) {
+        if (str[i] < '0' || str[i] > '9' || result > (UINT64_C(1) << 63) / 10)
+            return AVERROR_INVALIDDATA;
+        result = result * 10 + (uint64_t) (str[i] - '0');
+    }
+    if (result > (uint64_t) INT64_MAX + negative)
+        return AVERROR_INVALIDDATA;
+    *value = negative ? (int64_t) (0 - result) : (int64_t) result;
+    return 0;
+}
+
+static int next_text(struct timestamps *input, int64_t *us) {
+    int ret;
+    for (;;) {
+        size_t end;
+        while (input->start < input->end && is_space(input->buffer[input->start]))
+            input->start++;
+        if (input->start == input->end) {
+            if (input->eof)
+                return 0;
+            if ((ret = fill(input)) < 0)
+                return ret;
+            continue;
+        }
+        for (end = input->start; end < input->end && !is_space(input->buffer[end]); end++);
+        if (end == input->end && !input->eof) {
+            if ((ret = fill(input)) < 0)
+                return ret;
+            continue;
+        }
+        ret = parse_integer(input->buffer + input->start, end - input->start, us);
+        input->start = end;
+        return ret < 0 ? ret : 1;
+    }
+}
+
+static int next_binary(struct timestamps *input, int64_t *us) {
+    int ret;
+    uint64_t value = 0;
+    while (input->end - input->start < 8) {
+        if (input->eof)
+            return input->end > input->start ? AVERROR_INVALIDDATA : 0;
+        if ((ret = fill(input)) < 0)
+            return ret;
+    }
+    for (int i = 7; i >= 0; i--)
+        value = value << 8 | (uint8_t) input->buffer[input->start + i];
+    input->start += 8;
+    *us = (int64_t) value;
+    return 1;
+}
+
+static int token_equals(const struct timestamps *input, jsmntok_t token, const char *str) {
+    size_t size = strlen(str);
+    return token.type == JSMN_STRING && (size_t) (token.end - token.start) == size &&
+           memcmp(json_buffer(&input->json) + token.start, str, size) == 0;
+}
+
+/*
+ * Parses a time value, in seconds or [-][HH:]MM:SS[.m...], into us.
+ */
+static int parse_time(const struct timestamps *input, jsmntok_t value, int64_t *us) {
+    char time_str[TIME_STRING_MAX];
+    size_t size = (size_t) FFMIN(value.end - value.start, TIME_STRING_MAX - 1);
+
+    memcpy(time_str, json_buffer(&input->json) + value.start, size);
+    time_str[size] = '\0';
+    *us = 0;
+    return av_parse_time(us, time_str, 1);
+}
+
+/*
+ * Starts expanding the range object at input->token, if it is one, and moves past it. Returns 1 for a range,
+ * 0 for any other object, which is then read key by key, or a negative error code.
+ */
+static int open_range(struct timestamps *input, jsmntok_t object) {
+    int ret, has_from = 0, has_to = 0;
+    unsigned int token = input->token + 1;
+    int64_t every = 0, frames = 0;
+
+    for (int pair = 0; pair < object.size && token + 1 < json_token_count(&input->json); pair++, token += 2) {
+        jsmntok_t key = json_token(&input->json, token);
+        jsmntok_t value = json_token(&input->json, token + 1);
+        if (value.type != JSMN_STRING && value.type != JSMN_PRIMITIVE)
+            return 0;
+        if (token_equals(input, key, "from"))
+            has_from = (ret = parse_time(input, value, &input->range_from)) == 0;
+        else if (token_equals(input, key, "to"))
+            has_to = (ret = parse_time(input, value, &input->range_to)) == 0;
+        else if (token_equals(input, key, "every"))
+            ret = parse_time(input, value, &every);
+        else if (token_equals(input, key, "frames"))
+            ret = parse_integer(json_buffer(&input->json) + value.start, (size_t) (value.end - value.start), &frames);
+        else
+            ret = 0;
+        if (ret < 0) {
+            fprintf(stderr, "Invalid value in a range at offset %d\n", value.start);
+            return AVERROR_INVALIDDATA;
+        }
+    }
+    if (!has_from)
+        return 0;
+    if (!has_to || (every > 0) == (frames > 0) || input->range_to < input->range_from || every < 0 || frames < 0) {
+        fprintf(stderr, "A range at offset %d needs from, to and either every or frames\n", object.start);
+        return AVERROR_INVALIDDATA;
+    }
+    if (frames > 0) {
+        if (input->frame_rate.num <= 0 || input->frame_rate.den <= 0) {
+            fprintf(stderr, "Unknown frame rate for the range at offset %d\n", object.start);
+            return AVERROR_INVALIDDATA;
+        }
+        input->range_step_num = frames * input->frame_rate.den * 1000000;
+        input->range_step_den = input->frame_rate.num;
+    } else {
+        input->range_step_num = every;
+        input->range_step_den = 1;
+    }
+    input->range_index = 0;
+    input->in_range = 1;
+    input->token = token;
+    return 1;
+}
+
+/*
+ * The times of a range are computed from its start, so that frame steps do not drift over long ranges.
+ */
+static int next_range(struct timestamps *input, int64_t *us, int *sequential) {
+    int64_t ts = input->range_from + av_rescale(input->range_index, input->range_step_num, input->range_step_den);
+    if (ts > input->range_to) {
+        input->in_range = 0;
+        return 0;
+    }
+    *us = ts;
+    *sequential = input->range_index > 0;
+    input->range_index++;
+    return 1;
+}
+
+static int next_json(struct timestamps *input, int64_t *us, int *sequential) {
+    int ret;
+    if (input->in_range && next_range(input, us, sequential))
+        return 1;
+    while (input->token + 1 < json_token_count(&input->json)) {
+        jsmntok_t key = json_token(&input->json, input->token);
+        if (key.type == JSMN_OBJECT && (ret = open_range(input, key)) != 0) {
+            if (ret < 0)
+                return ret;
+            if (next_range(input, us, sequential))
+                return 1;
+            continue;
+        }
+        input->token++;
+        if (token_equals(input, key, "time")) {
+            parse_time(input, json_token(&input->json, input->token++), us);
+            *sequential = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * The frame rate of the source, which the frame step ranges are expanded with.
+ */
+void timestamps_set_frame_rate(struct timestamps *input, AVRational frame_rate) {
+    input->frame_rate = frame_rate;
+}
+
+/*
+ * Returns 1 and the next time in us, 0 at the end of the input or a negative error code. sequential is set
+ * if the time follows the previous one within a range, so that it is reached by decoding forward.
+ */
+int timestamps_next(struct timestamps *input, int64_t *us, int *sequential) {
+    *sequential = 0;
+    switch (input->format) {
+        case TIMESTAMPS_TEXT:
+            return next_text(input, us);
+        case TIMESTAMPS_BINARY:
+            return next_binary(input, us);
+        default:
+            return next_json(input, us, sequential);
+    }
+}
+
+/*
+ * Reads the next window of times into the growing arrays times and sequential, see timestamps_next.
+ * Streamed input ends the window early, as soon as reading on would wait for more data, so that the frames
+ * requested so far come out while the rest is still arriving. Ranges end it after window times, so that
+ * a long range is never held in memory as a whole.
+ * Returns the number of times read or a negative error code.
+ */
+int timestamps_read(struct timestamps *input, unsigned int window, int64_t **times, uint8_t **sequential,
+                    unsigned int *capacity) {
+    int ret, in_range = 0;
+    unsigned int count = 0;
+    int streaming = timestamps_streaming(input);
+
+    while ((!streaming && !in_range) || count < window) {
+        if (streaming && count > 0 && !timestamps_ready(input))
+            break;
+        if (count == *capacity) {
+            unsigned int grown = *capacity > 0 ? *capacity * 2 : 1024;
+            int64_t *resized = realloc(*times, grown * sizeof(int64_t));
+            uint8_t *resized_sequential;
+            if (resized == NULL)
+                return AVERROR(ENOMEM);
+            *times = resized;
+            if ((resized_sequential = realloc(*sequential, grown)) == NULL)
+                return AVERROR(ENOMEM);
+            *sequential = resized_sequential;
+            *capacity = grown;
+        }
+        if ((ret = timestamps_next(input, &(*times)[count], &in_range)) < 0) {
+            fprintf(stderr, "Could not read the timestamps: %s\n", av_err2str(ret));
+            return ret;
+        }
+        if (ret == 0)
+            break;
+        (*sequential)[count++] = (uint8_t) in_range;
+    }
+    return (int) count;
+}
+
+/*
+ * Tells whether timestamps_next would return without waiting for more input.
+ */
+int timestamps_ready(struct timestamps *input) {
+    if (input->format == TIMESTAMPS_JSON || input->eof)
+        return 1;
+    if (input->format == TIMESTAMPS_BINARY && input->end - input->start >= 8)
+        return 1;
+    while (input->format == TIMESTAMPS_TEXT && input->start < input->end && is_space(input->buffer[input->start]))
+        input->start++;
+    if (input->format == TIMESTAMPS_TEXT &&
+        memchr(input->buffer + input->start, '\n', input->end - input->start) != NULL)
+        return 1;
+#ifdef _WIN32
+    return 0;
+#else
+    struct pollfd pfd = {.fd = input->fd, .events = POLLIN};
+    return poll(&pfd, 1, 0) > 0;
+#endif
+}
+
+int timestamps_streaming(const struct timestamps *input) {
+    return input->format != TIMESTAMPS_JSON;
+}
+
+void timestamps_close(struct timestamps *input) {
+    if (input->format == TIMESTAMPS_JSON)
+        json_free(&input->json);
+    else if (input->fd > STDIN_FILENO)
+        close(input->fd);
+    input->fd = -1;
+}
@@ -0,0 +1,53 @@
+#ifndef FRAME_EXTRACTOR_TIMESTAMPS_H
+#define FRAME_EXTRACTOR_TIMESTAMPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <libavutil/rational.h>
+#include "json.h"
+
+#define TIMESTAMPS_BUFFER_SIZE 65536
+
+enum timestamps_format {
+    TIMESTAMPS_JSON,
+    TIMESTAMPS_TEXT,
+    TIMESTAMPS_BINARY
+};
+
+/*
+ * Reads the requested times, in microseconds, from a file or from stdin ("-").
+ * JSON input is parsed as a whole. Text (one integer per line) and binary (little-endian int64 records)
+ * input is read through a fixed buffer as it arrives, without any allocation per timestamp.
+ *
+ * JSON input may also hold ranges, {"from": ..., "to": ..., "every": ...} or {"from": ..., "to": ...,
+ * "frames": N} for every Nth frame, which are expanded one time at a time as they are read.
+ */
+struct timestamps {
+    enum timestamps_format format;
+    int fd;
+    int eof;
+    struct json json;
+    unsigned int token;
+    AVRational frame_rate;
+    int in_range;
+    int64_t range_from;
+    int64_t range_to;
+    int64_t range_step_num;
+    int64_t range_step_den;
+    int64_t range_index;
+    size_t start;
+    size_t end;
+    char buffer[TIMESTAMPS_BUFFER_SIZE];
+};
+
+int timestamps_parse_format(const char *name, enum timestamps_format *format);
+int timestamps_open(struct timestamps *input, const char *filename, enum timestamps_format format);
+void timestamps_set_frame_rate(struct timestamps *input, AVRational frame_rate);
+int timestamps_next(struct timestamps *input, int64_t *us, int *sequential);
+int timestamps_read(struct timestamps *input, unsigned int window, int64_t **times, uint8_t **sequential,
+                    unsigned int *capacity);
+int timestamps_ready(struct timestamps *input);
+int timestamps_streaming(const struct timestamps *input);
+void timestamps_close(struct timestamps *input);
+
+#endif //FRAME_EXTRACTOR_TIMESTAMPS_H
@@ -0,0 +1,283 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include "writer.h"
+
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define AVIO_BUFFER_SIZE 65536
+
+/*
+ * A run of bytes to write at offset. The last block of a file also closes it.
+ */
+struct writer_block {
+    int fd;
+    int close;
+    int64_t offset;
+    size_t size;
+    unsigned char data[];
+};
+
+struct writer_file {
+    struct writer *writer;
+    int fd;
+    int64_t pos;
+    int64_t size;
+    struct writer_block *block;
+};
+
+static int write_at(int fd, const unsigned char *data, size_t size, int64_t offset) {
+#ifdef _WIN32
+    if (_lseeki64(fd, offset, SEEK_SET) < 0)
+        return AVERROR(errno);
+#endif
+    while (size > 0) {
+#ifdef _WIN32
+        int written = write(fd, data, size > INT_MAX ? INT_MAX : (unsigned int) size);
+#else
+        ssize_t written = pwrite(fd, data, size, (off_t) offset);
+#endif
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return AVERROR(errno);
+        }
+        data += written;
+        size -= (size_t) written;
+        offset += written;
+    }
+    return 0;
+}
+
+static int sync_fd(int fd) {
+#if defined(_WIN32)
+    return _commit(fd) == 0 ? 0 : AVERROR(errno);
+#elif defined(__APPLE__)
+    return fsync(fd) == 0 ? 0 : AVERROR(errno);
+#else
+    return fdatasync(fd) == 0 ? 0 : AVERROR(errno);
+#endif
+}
+
+static int writer_error(struct writer *writer) {
+    int error;
+    pthread_mutex_lock(&writer->lock);
+    error = writer->error;
+    pthread_mutex_unlock(&writer->lock);
+    return error;
+}
+
+static void *writer_main(void *arg) {
+    struct writer *writer = arg;
+    struct writer_block *block;
+
+    while ((block = queue_pop(&writer->blocks)) != NULL) {
+        int ret = writer_error(writer);
+        if (ret == 0)
+            ret = write_at(block->fd, block->data, block->size, block->offset);
+        if (ret == 0 && block->close && writer->sync)
+            ret = sync_fd(block->fd);
+        if (block->close && close(block->fd) != 0 && ret == 0)
+            ret = AVERROR(errno);
+        pthread_mutex_lock(&writer->lock);
+        if (ret < 0 && writer->error == 0)
+            writer->error = ret;
+        else if (ret == 0)
+            writer->bytes_written += block->size;
+        pthread_mutex_unlock(&writer->lock);
+        free(block);
+    }
+    return NULL;
+}
+
+static struct writer_block *new_block(struct writer_file *file, size_t capacity) {
+    struct writer_block *block = malloc(sizeof(struct writer_block) + capacity);
+    if (block == NULL)
+        return NULL;
+    block->fd = file->fd;
+    block->close = 0;
+    block->offset = file->pos;
+    block->size = 0;
+    return block;
+}
+
+/*
+ * Queues the current block, or an empty one to close the file. A block the queue refuses is freed by queue_push,
+ * and the file is then left open for the caller to close.
+ */
+static int submit_block(struct writer_file *file, int close) {
+    struct writer_block *block = file->block;
+    if (block == NULL && (block = new_block(file, 0)) == NULL)
+        return AVERROR(ENOMEM);
+    file->block = NULL;
+    block->close = close;
+    return queue_push(&file->writer->blocks, block);
+}
+
+/*
+ * Appends to the current block, which is queued once full or when the muxer has seeked away from its end.
+ */
+static int write_packet(void *opaque, uint8_t *buf, int buf_size) {
+    int ret;
+    int size = buf_size;
+    struct writer_file *file = opaque;
+    struct writer *writer = file->writer;
+
+    if ((ret = writer_error(writer)) < 0)
+        return ret;
+    while (size > 0) {
+        struct writer_block *block = file->block;
+        if (block != NULL &&
+            (block->offset + (int64_t) block->size != file->pos || block->size == writer->buffer_size)) {
+            if ((ret = submit_block(file, 0)) < 0)
+                return ret;
+            block = NULL;
+        }
+        if (block == NULL && (block = file->block = new_block(file, writer->buffer_size)) == NULL)
+            return AVERROR(ENOMEM);
+        size_t length = FFMIN((size_t) size, writer->buffer_size - block->size);
+        memcpy(block->data + block->size, buf, length);
+        block->size += length;
+        buf += length;
+        size -= (int) length;
+        file->pos += (int64_t) length;
+        if (file->pos > file->size)
+            file->size = file->pos;
+    }
+    return buf_size;
+}
+
+static int64_t seek_file(void *opaque, int64_t offset, int whence) {
+    int64_t pos;
+    struct writer_file *file = opaque;
+
+    if (whence & AVSEEK_SIZE)
+        return file->size;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = file->pos + offset;
+            break;
+        case SEEK_END:
+            pos = file->size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (pos < 0)
+        return AVERROR(EINVAL);
+    file->pos = pos;
+    return pos;
+}
+
+/*
+ * Starts the writer thread. At most `depth` full blocks of buffer_size bytes wait for the disk at a time.
+ * With sync set, every file is flushed to the disk with fdatasync before it is closed.
+ */
+int writer_init(struct writer *writer, size_t buffer_size, unsigned int depth, int sync) {
+    int ret;
+    writer->buffer_size = buffer_size;
+    writer->sync = sync;
+    writer->started = 0;
+    writer->error = 0;
+    writer->bytes_written = 0;
+    writer->files = 0;
+    pthread_mutex_init(&writer->lock, NULL);
+    if ((ret = queue_init(&writer->blocks, "write", depth, free)) < 0)
+        return ret;
+    if (pthread_create(&writer->thread, NULL, writer_main, writer) != 0)
+        return AVERROR(EAGAIN);
+    writer->started = 1;
+    return 0;
+}
+
+int writer_open(struct writer *writer, AVIOContext **pb, const char *filename) {
+    int ret;
+    struct writer_file *file = calloc(1, sizeof(struct writer_file));
+    unsigned char *buffer = av_malloc(AVIO_BUFFER_SIZE);
+
+    if (file == NULL || buffer == NULL) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    file->writer = writer;
+    if ((file->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666)) < 0) {
+        ret = AVERROR(errno);
+        goto fail;
+    }
+    *pb = avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 1, file, NULL, write_packet, seek_file);
+    if (*pb == NULL) {
+        close(file->fd);
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    (*pb)->seekable = AVIO_SEEKABLE_NORMAL;
+    writer->files++;
+    return 0;
+
+    fail:
+    free(file);
+    av_free(buffer);
+    return ret;
+}
+
+/*
+ * Flushes the AVIOContext and hands the rest of the file over to the writer thread, which closes it.
+ * Returns the first error of the writer so far.
+ */
+int writer_close(struct writer *writer, AVIOContext **pb) {
+    int ret, error;
+    struct writer_file *file;
+
+    if (*pb == NULL)
+        return 0;
+    file = (*pb)->opaque;
+    avio_flush(*pb);
+    if ((ret = submit_block(file, 1)) < 0)
+        close(file->fd);
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+    free(file);
+    error = writer_error(writer);
+    return ret < 0 ? ret : error;
+}
+
+void writer_report(struct writer *writer) {
+    queue_report(&writer->blocks);
+    pthread_mutex_lock(&writer->lock);
+    fprintf(stderr, "Writer: %.1f MiB in %lu files\n", writer->bytes_written / 1048576.0,
+            (unsigned long) writer->files);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+/*
+ * Waits for the pending blocks to reach the disk and stops the writer thread. Returns the first write error.
+ */
+int writer_free(struct writer *writer) {
+    int ret;
+    if (writer->blocks.items == NULL)
+        return 0;
+    queue_close(&writer->blocks);
+    if (writer->started)
+        pthread_join(writer->thread, NULL);
+    writer->started = 0;
+    queue_free(&writer->blocks);
+    ret = writer->error;
+    pthread_mutex_destroy(&writer->lock);
+    return ret;
+}
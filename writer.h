@@ -0,0 +1,33 @@
+#ifndef FRAME_EXTRACTOR_WRITER_H
+#define FRAME_EXTRACTOR_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <libavformat/avio.h>
+#include "queue.h"
+
+/*
+ * Output files written by a background thread. The muxer writes into large blocks through a custom AVIOContext,
+ * full blocks are queued to the thread, and closing a file only queues its last block, so neither writing
+ * nor finishing a file waits for the disk unless `depth` blocks are already pending.
+ */
+struct writer {
+    size_t buffer_size;
+    int sync;
+    struct queue blocks;
+    pthread_t thread;
+    int started;
+    pthread_mutex_t lock;
+    int error;
+    uint64_t bytes_written;
+    uint64_t files;
+};
+
+int writer_init(struct writer *writer, size_t buffer_size, unsigned int depth, int sync);
+int writer_open(struct writer *writer, AVIOContext **pb, const char *filename);
+int writer_close(struct writer *writer, AVIOContext **pb);
+void writer_report(struct writer *writer);
+int writer_free(struct writer *writer);
+
+#endif //FRAME_EXTRACTOR_WRITER_H